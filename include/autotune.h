@@ -0,0 +1,53 @@
+// Motion Auto-Tune
+// Finds how hard each paint head axis can be driven on this machine, with
+// its own carriage load and hose drag. For X, then Y: a ladder of
+// accelerations at the current rapid speed, then a ladder of speeds at the
+// acceleration found. Each level runs TUNE_CYCLES round trips out from the
+// home corner, TUNE_MOVE_INCHES or as far as it takes to cruise at the
+// level's speed, then a step-loss check against the home switch
+// (homingCheckStart()) at the old, known-good limits. The first level that
+// drifts by more than TUNE_DRIFT_STEPS ends its ladder, and the result is
+// the last clean level times TUNE_MARGIN. A drift past the check's range
+// fails the level too and re-homes the machine. A speed ladder also ends,
+// at its last clean level, at the first speed the axis cannot reach within
+// TUNE_MAX_TRAVEL_INCHES.
+// There is no accelerometer, so a resonance only shows up as the steps it
+// costs; the round trips are long enough to ring through the band the
+// pattern moves use.
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <Arduino.h>
+#include "step_engine.h"
+
+const float TUNE_MOVE_INCHES = 6.0;
+const float TUNE_CRUISE_INCHES = 1.0;        // At the trial speed, each way
+const float TUNE_MAX_TRAVEL_INCHES = 24.0;   // Inside the smallest canvas the booth paints
+const uint8_t TUNE_CYCLES = 4;               // Round trips per level
+const long TUNE_DRIFT_STEPS = 2;             // More than this at a check fails the level
+const float TUNE_STEP = 1.25;                // Ratio between levels
+const uint8_t TUNE_LEVELS = 8;               // Per ladder, up to 1.25^7 = 4.8x the start
+const float TUNE_MARGIN = 0.8;               // Kept below the last clean level when the next failed
+const float TUNE_MAX_SPEED = STEP_TICK_HZ * 0.45f;   // Step engine limit is half the tick rate
+
+struct TuneResult {
+    float speed;          // Steps/s
+    float accel;          // Steps/s^2
+    long failDrift;       // Drift at the level that failed, 0 if none or past the check range
+    bool limited;         // A level failed, rather than the ladders running out
+};
+
+void autotuneBegin(StepAxis* x, StepAxis* y);
+// Start from standstill after homing; speed/accel are the current limits
+// per axis (X, Y) and the first rung of each ladder
+void autotuneStart(const float speed[2], const float accel[2]);
+void autotuneUpdate();                       // Call every loop() pass while tuning
+void autotuneAbort();                        // Restores the axis limits, the caller stops the axes
+
+bool autotuneActive();
+bool autotuneDone();
+bool autotuneFailed();                       // Homing could not find a switch
+const TuneResult& autotuneResult(uint8_t axis);   // 0 = X, 1 = Y
+
+#endif
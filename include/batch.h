@@ -0,0 +1,30 @@
+// Batch Queue
+// Canvases waiting to be painted back to back, each with its own side
+// selection and speed. Identical canvases share one entry with a count, so
+// the queue holds BATCH_QUEUE_SIZE different set-ups however many canvases
+// they cover. main.cpp runs the batch: the tray turns back to side 1 while
+// the head returns home, and the next canvas starts on N without homing
+// unless BATCH_HOME_EVERY canvases have gone by.
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <Arduino.h>
+
+const uint8_t BATCH_QUEUE_SIZE = 8;
+const uint8_t BATCH_HOME_EVERY = 10;     // Canvases painted between re-homing
+
+struct BatchCanvas {
+    uint8_t sides;          // Bit n = side n + 1
+    uint8_t speedPercent;   // X/Y speed, 1-100
+    uint8_t count;          // Canvases left with this set-up
+};
+
+bool batchAdd(const BatchCanvas& canvas);    // False when the queue is full
+bool batchNext(BatchCanvas& out);            // Take one canvas, out.count is what remains of its entry
+uint16_t batchRemaining();                   // Canvases left in the queue
+uint8_t batchEntries();
+const BatchCanvas& batchEntry(uint8_t index);   // Oldest first
+void batchClear();
+
+#endif
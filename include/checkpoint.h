@@ -0,0 +1,54 @@
+// Job Checkpoints
+// Keeps where a pattern job stands in the RA4M1 data flash, so a job stopped
+// by E or by a power loss can be resumed after re-homing instead of being
+// repainted from the start.
+//
+// Records are appended to a log over the data flash blocks ahead of the
+// settings blocks (data_flash.h): each slot is written once and carries a
+// sequence number and a CRC, the newest valid record wins. The log runs
+// round the blocks in turn, which spreads the erase cycles over every block.
+// A record is programmed a few bytes per loop() pass (checkpointService()),
+// and erases are held back until the machine is not moving, so flash work
+// never holds up motion. While it stands still every block but the one with
+// the newest record is erased; with four blocks that is room for at least
+// 96 records. A job writes one record a second, or fewer when its estimated
+// length would not fit the free slots (checkpointFreeSlots()), so a long job
+// still has records up to its end. Should the log fill anyway, later records
+// are refused, which checkpointStalled() reports.
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <Arduino.h>
+
+const uint8_t CHECKPOINT_STATUS_ACTIVE = 1;   // Job in progress, can be resumed
+const uint8_t CHECKPOINT_STATUS_CLEAR = 2;    // Nothing to resume
+
+const unsigned long CHECKPOINT_INTERVAL_MS = 1000;   // Between records while a job runs
+const uint8_t CHECKPOINT_BYTES_PER_SERVICE = 8;      // Flash bytes programmed per loop() pass
+const uint8_t CHECKPOINT_RESERVED_SLOTS = 8;         // Kept for pause, stop and end-of-job records
+
+struct CheckpointRecord {
+    uint32_t sequence;
+    uint8_t status;
+    uint8_t side;
+    uint16_t command;          // First command not yet finished
+    int32_t stepsDone;         // Progress along that command
+    int32_t position[3];       // X, Y, R at that point
+    uint32_t canvasHash;       // Pattern geometry and motion profiles the job was planned with
+    uint8_t sides;             // Selected sides, bit n = side n + 1; bits 4-5 the tray quarter the job started at
+    uint8_t speedPercent;      // X/Y speed the job ran at (0 = 100)
+    uint16_t crc;              // CRC-16/CCITT over everything before it
+};
+
+static_assert(sizeof(CheckpointRecord) == 32, "CheckpointRecord must fill one flash slot");
+
+bool checkpointBegin();                       // Open the flash and find the newest record
+bool checkpointLoad(CheckpointRecord& out);   // Newest record, false if none is valid
+bool checkpointWrite(const CheckpointRecord& record);   // False while the previous write is still going
+void checkpointService(bool idle);            // Call every loop() pass, idle allows erases
+bool checkpointBusy();
+bool checkpointStalled();                     // Records refused until the next erase, the log is full
+uint16_t checkpointFreeSlots();               // Erased slots ahead of the log before a used block
+
+#endif
@@ -0,0 +1,58 @@
+// Command Structures
+// Command is the decoded form handed to executeCommand(), with distances
+// already in steps. PatternOp is the packed form the side patterns are stored
+// in: one 32-bit word per command, built at compile time so the pattern
+// tables live in flash and carry no float math into the executor.
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <Arduino.h>
+
+class Command {
+public:
+    char type;      // 'X' for X move, 'Y' for Y move, 'R' for rotate, 'S' for spray, 'M' for combined move,
+                    // 'W' for spray window (steps = window width in X from here, sprayOn = enable)
+    bool sprayOn;   // Whether spray should be on during movement
+    long steps;     // Steps on the command's axis ('M': X steps)
+    long stepsY;    // 'M' only: Y steps
+    long stepsR;    // 'M' only: rotation steps
+
+    Command() : type('S'), sprayOn(false), steps(0), stepsY(0), stepsR(0) {}
+    Command(char t, long s, bool spray) : type(t), sprayOn(spray), steps(s), stepsY(0), stepsR(0) {}
+    Command(long x, long y, long r, bool spray) : type('M'), sprayOn(spray), steps(x), stepsY(y), stepsR(r) {}
+};
+
+// Unit conversion for compile-time pattern tables, rounded to the nearest step
+constexpr long toSteps(double value, double stepsPerUnit) {
+    return (long)(value * stepsPerUnit + (value >= 0 ? 0.5 : -0.5));
+}
+
+// Packed pattern entry
+//   bits 0-2   opcode: X, Y, R, S, W
+//   bit  3     spray
+//   bits 4-31  signed step count
+class PatternOp {
+public:
+    constexpr PatternOp(char type, long steps, bool spray)
+        : bits(((uint32_t)steps << 4) | ((uint32_t)spray << 3) | opcode(type)) {}
+
+    char type() const {
+        static const char TYPES[] = {'X', 'Y', 'R', 'S', 'W', 'S', 'S', 'S'};
+        return TYPES[bits & 0x7];
+    }
+    bool sprayOn() const { return bits & 0x8; }
+    long steps() const { return (int32_t)bits >> 4; }
+    Command toCommand() const { return Command(type(), steps(), sprayOn()); }
+
+private:
+    static constexpr uint32_t opcode(char type) {
+        return type == 'X' ? 0 : type == 'Y' ? 1 : type == 'R' ? 2 : type == 'W' ? 4 : 3;
+    }
+
+    uint32_t bits;
+};
+
+static_assert(sizeof(PatternOp) == 4, "PatternOp must stay one word");
+
+#endif
@@ -0,0 +1,44 @@
+// Machine Configuration
+// Pin assignments, axis calibration and motion limits shared by every module.
+// The calibration and speed/accel values are defined in main.cpp and can be
+// replaced at runtime from the saved configuration (settings.h).
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <Arduino.h>
+
+// Pin Definitions
+const int X_STEP_PIN = 5;
+const int X_DIR_PIN = 6;
+const int Y_STEP_PIN = 11;
+const int Y_DIR_PIN = 10;
+const int ROTATION_STEP_PIN = A1;
+const int ROTATION_DIR_PIN = A0;
+const int PAINT_RELAY_PIN = 4;
+const int FLUSH_VALVE_PIN = 7;        // Water feed to the gun, see purge.h
+const int ESTOP_PIN = 2;              // Normally-closed E-stop contact, see estop.h
+const int X_HOME_SENSOR_PIN = 12;
+const int Y_HOME_SENSOR_PIN = 8;
+
+// System Configuration
+const bool ESTOP_ENABLED = false;     // Set once the E-stop contact is wired to ESTOP_PIN, see README
+const unsigned long SERIAL_BAUD = 921600;  // Text commands and binary frames share the link
+const int STEPS_PER_ROTATION = 800;       // Rotation motor steps per motor turn
+const int ROTATION_TRAY_TEETH = 25;        // Tray gear, see rotary.h
+const int ROTATION_MOTOR_TEETH = 4;        // Motor pulley
+const long ROTATION_STEPS_PER_TURN = (long)STEPS_PER_ROTATION * ROTATION_TRAY_TEETH / ROTATION_MOTOR_TEETH;
+static_assert((long)STEPS_PER_ROTATION * ROTATION_TRAY_TEETH % (4L * ROTATION_MOTOR_TEETH) == 0,
+              "Quarter tray turns must be whole steps");
+const double ROTATION_STEPS_PER_DEGREE = ROTATION_STEPS_PER_TURN / 360.0;
+extern int X_STEPS_PER_INCH;
+extern int Y_STEPS_PER_INCH;
+extern int X_SPEED;
+extern int Y_SPEED;
+extern int ROTATION_SPEED;
+extern int X_ACCEL;
+extern int Y_ACCEL;
+extern int ROTATION_ACCEL;
+extern int ROTATION_JERK;
+
+#endif
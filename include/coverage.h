@@ -0,0 +1,54 @@
+// Spray Coverage
+// Records which part of each side actually got paint, so a job stopped by P,
+// E or the E-stop can be finished by repainting only what was missed
+// (TOUCHUP) instead of guessing and repainting the whole side.
+//
+// Each side's rows are mapped as COVERAGE_CELLS cells along the pass, one
+// bit each, over the band the rows cover (raster.h). coverageUpdate() is fed
+// the step positions and the relay every motion pass: a cell is painted once
+// the head passed its centre on a row line while paint was landing. Paint
+// lands the valve's open lead after the relay opens and stops the close lead
+// after it closes, the same times the planner switches the relay ahead by.
+// Each row also sums the time paint was landing on it.
+//
+// A map is started (and cleared) for every selected side when a job
+// starts, with that side's geometry, and stays across P/G, E and resumes
+// until the next job or M0. Positions are only trusted after homing, so a
+// job resumed after a power loss is not mapped. Rows past COVERAGE_MAX_ROWS
+// are not mapped.
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <Arduino.h>
+#include "raster.h"
+
+const uint8_t COVERAGE_MAX_ROWS = 64;        // Per side
+const uint8_t COVERAGE_CELLS = 64;           // Per row, a 26" pass gives 0.4" cells
+
+struct CoverageGap {
+    uint8_t row;
+    long fromX;           // Missed run along the row, steps, fromX < toX
+    long toX;
+    long y;               // Row line
+};
+
+// Clear a side's map and record it from here on with the side's geometry
+// and valve leads
+void coverageStart(uint8_t side, const RasterSide& geometry, unsigned openLeadMs, unsigned closeLeadMs);
+void coverageClear();                        // Every side unmapped
+// Call every motion pass; side is the one the running move paints, -1 when none
+void coverageUpdate(int side, long x, long y, bool relayOn);
+
+bool coverageMapped(uint8_t side);
+uint8_t coverageRows(uint8_t side);          // Mapped rows
+uint8_t coverageRowsSkipped(uint8_t side);   // Past COVERAGE_MAX_ROWS
+bool coverageCell(uint8_t side, uint8_t row, uint8_t cell);
+float coverageRowSeconds(uint8_t side, uint8_t row);
+uint16_t coveragePainted(uint8_t side);      // Cells
+uint16_t coverageGaps(uint8_t side);         // Missed runs
+
+// First missed run at or after row/cell; moves them past it
+bool coverageNextGap(uint8_t side, uint8_t& row, uint8_t& cell, CoverageGap& gap);
+
+#endif
@@ -0,0 +1,12 @@
+// CRC-16/CCITT
+// Polynomial 0x1021, initial value 0xFFFF, no reflection. Guards the
+// checkpoint records in flash and the binary serial frames.
+
+#ifndef CRC_H
+#define CRC_H
+
+#include <Arduino.h>
+
+uint16_t crc16(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF);
+
+#endif
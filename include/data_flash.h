@@ -0,0 +1,27 @@
+// Data Flash
+// The RA4M1's 8 KB data flash, shared by the checkpoint log (checkpoint.h)
+// and the machine settings and configuration (settings.h), each in its own
+// blocks. Erased bytes read 0xFF and programming can only clear bits, so
+// every user keeps append-only slots and erases whole blocks. All calls
+// block; the code flash stays readable meanwhile, so the step interrupt
+// keeps running.
+// Host builds keep the "flash" in RAM.
+
+#ifndef DATA_FLASH_H
+#define DATA_FLASH_H
+
+#include <Arduino.h>
+
+const uint32_t DATA_FLASH_SIZE = 8192;
+const uint32_t DATA_FLASH_BLOCK_SIZE = 1024;   // Erase unit
+const uint8_t SETTINGS_LOG_BLOCKS = 2;        // Per settings record log, written in turn
+const uint32_t SETTINGS_FLASH_OFFSET = DATA_FLASH_SIZE - SETTINGS_LOG_BLOCKS * DATA_FLASH_BLOCK_SIZE;   // Last blocks
+const uint32_t CONFIG_FLASH_OFFSET = SETTINGS_FLASH_OFFSET - SETTINGS_LOG_BLOCKS * DATA_FLASH_BLOCK_SIZE;  // The ones before, the checkpoint log has the rest
+
+bool dataFlashOpen();                          // Safe to call more than once
+void dataFlashRead(uint32_t offset, void* out, uint32_t length);
+bool dataFlashProgram(uint32_t offset, const uint8_t* data, uint32_t length);
+bool dataFlashErase(uint32_t offset);          // The block at offset
+bool dataFlashBlank(uint32_t offset, uint32_t length);
+
+#endif
@@ -0,0 +1,43 @@
+// Cycle-Time Estimator
+// Predicts how long the selected sides take without moving anything. It walks
+// the side patterns from rasterOp() and follows the planner's rules for when
+// a move may start: after the previous move on its axis, inside the blend
+// window of a move on another axis where the relay stays shut across the
+// corner, or after everything for spray switches, lines and spray windows.
+// Each move is a rest-to-rest trapezoid at the axis limits.
+// Junction speeds between same-axis moves and valve lead holds are not
+// modelled; both are small for the raster patterns.
+//
+// Moves made with the spray on are timed at the spray limits, others at the
+// dry limits, as S-curves on axes with a jerk limit and as shaped moves on
+// axes with an input shaper.
+// Spray time counts the moves made with the spray on, and for racetrack
+// rows only the part of each pass inside the spray window.
+
+#ifndef ESTIMATOR_H
+#define ESTIMATOR_H
+
+#include <Arduino.h>
+#include "planner.h"
+#include "shaper.h"
+
+struct AxisMotion {
+    float speed;       // Steps/s
+    float accel;       // Steps/s^2
+    float blend;       // Corner blend, see plannerSetCornerBlend()
+    float spraySpeed;  // While the spray is on, see plannerSetSprayLimits()
+    float sprayAccel;
+    float jerk;        // Dry moves, see plannerSetJerk()
+    Shaper shaper;     // All moves, see plannerSetShaper()
+};
+
+struct SideEstimate {
+    float seconds;
+    float spraySeconds;
+};
+
+void estimatorBegin();                       // Start a new job timeline at the origin
+SideEstimate estimatorSide(uint8_t side, const AxisMotion motion[PLAN_AXIS_COUNT]);
+float estimatorMoveSeconds(long steps, const AxisMotion& motion);   // One rest-to-rest move
+
+#endif
@@ -0,0 +1,26 @@
+// Emergency Stop
+// Dedicated input for a normally-closed E-stop contact to ground. Opening
+// it (or a broken wire) raises a pin interrupt that calls stepEngineHalt():
+// the relay is cut and step output stops within one step tick, without
+// braking, instead of waiting for loop() to read an E and then
+// decelerating at the configured acceleration. The step counts at the trip
+// are kept for the job checkpoint. A hard stop at speed can lose steps on
+// the motors, so a tripped job is only resumed after re-homing (G).
+// Machines without the switch leave ESTOP_ENABLED (config.h) off, the input
+// is then never attached and never trips.
+
+#ifndef ESTOP_H
+#define ESTOP_H
+
+#include <Arduino.h>
+#include "step_engine.h"
+
+void estopBegin(uint8_t pin);            // Trips at once if the contact is already open
+void estopPoll();                        // Every loop() pass, backs up the interrupt
+bool estopTripped();
+bool estopInputOpen();                   // Contact open right now
+bool estopReset();                       // Releases the step engine, false while the contact is open
+const long* estopPositions();            // Step counts at the trip, construction order
+uint32_t estopTrippedAt();               // micros()
+
+#endif
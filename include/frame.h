@@ -0,0 +1,98 @@
+// Binary Frames
+// Compact framing for host programs that share the serial link with the
+// text commands. Streamed moves and status reports travel as fixed-point
+// values, so nothing is parsed from digits on either side:
+//   uint8  sync       FRAME_SYNC, never the first byte of a text line
+//   uint8  length     payload bytes, at most FRAME_MAX_PAYLOAD
+//   uint8  opcode
+//   uint8  payload[length]
+//   uint16 crc        CRC-16/CCITT over length, opcode and payload
+// Values are little-endian. Distances are int32 thousandths of an inch,
+// tray angles int32 millidegrees, flags uint8.
+//
+// Host to machine, the move opcodes are the Command types and are only
+// accepted while a job streams (J), with the job stream's credit rules:
+//   'X' 'Y'  int32 distance, uint8 spray
+//   'R'      int32 angle
+//   'S'      uint8 on
+//   'M'      int32 x, int32 y, int32 angle, uint8 spray
+//   'F'      end of the job (END)
+//   'C'      one text command line, answered in text ("J", "Q13,80,2", "E")
+//   'T'      uint16 period ms: a status frame now and then every period (0 = once)
+// Machine to host:
+//   'K'      move left the buffer ("ok")
+//   'N'      text reason, move or frame rejected ("error: ...")
+//   'T'      status, see sendStatusFrame() in main.cpp
+// A frame with a bad CRC or length, or one that stops arriving for
+// FRAME_TIMEOUT_MS, is dropped and answered with 'N'; bytes up to the next
+// sync byte (or until the link is quiet for FRAME_TIMEOUT_MS) are dropped
+// with it, so a damaged frame never turns into text. A host that lost frames
+// can take its credits from the buffered count in the status frame. The
+// timing dump record also starts with 0xA5, its second byte (0x5A) is longer
+// than any frame payload.
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <Arduino.h>
+
+const uint8_t FRAME_SYNC = 0xA5;
+const uint8_t FRAME_MAX_PAYLOAD = 63;          // 'C' lines up to 63 bytes
+const uint8_t FRAME_MAX_BYTES_PER_POLL = FRAME_MAX_PAYLOAD + 5;   // A whole frame: sync, length, opcode, payload, CRC
+const unsigned long FRAME_TIMEOUT_MS = 50;     // Between bytes of one frame
+
+const uint8_t FRAME_LINE = 'C';
+const uint8_t FRAME_END = 'F';
+const uint8_t FRAME_STATUS = 'T';
+const uint8_t FRAME_ACK = 'K';
+const uint8_t FRAME_REJECT = 'N';
+
+struct Frame {
+    uint8_t opcode;
+    uint8_t length;
+    uint8_t payload[FRAME_MAX_PAYLOAD + 1];    // Zero after the payload, 'C' lines are strings
+};
+
+enum FramePoll {
+    FRAME_NONE,
+    FRAME_READY,       // frame() holds a frame with a good CRC
+    FRAME_BAD          // A frame was dropped
+};
+
+class FrameReader {
+public:
+    FrameReader(Stream& stream);
+
+    // Consume whatever frame bytes are already waiting. Only starts on a
+    // sync byte, anything else is left for the LineReader.
+    FramePoll poll();
+
+    const Frame& frame() const { return current; }
+
+    // Part way through a frame, or dropping the rest of a bad one: the
+    // waiting bytes are not text
+    bool receiving() const { return inFrame || resyncing; }
+
+private:
+    Stream& stream;
+    Frame current;
+    uint8_t fill;      // Bytes received after the sync byte
+    uint16_t receivedCrc;
+    bool inFrame;
+    bool resyncing;    // Dropping bytes up to the next sync byte or a quiet link
+    unsigned long lastByteAt;
+};
+
+// Payload fields, offsets in bytes
+int32_t frameInt32(const Frame& frame, uint8_t offset);
+uint16_t frameUint16(const Frame& frame, uint8_t offset);
+void framePutInt32(uint8_t* out, int32_t value);
+void framePutUint16(uint8_t* out, uint16_t value);
+
+void frameSend(Print& out, uint8_t opcode, const uint8_t* payload, uint8_t length);
+void frameSendText(Print& out, uint8_t opcode, const char* text);
+
+// Fixed-point distance to steps, rounded to the nearest step
+long frameMilsToSteps(int32_t mils, long stepsPerInch);
+
+#endif
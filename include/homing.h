@@ -0,0 +1,53 @@
+// Homing
+// Two-stage homing for X and Y, both axes at once: a fast seek onto the home
+// switch, a short back-off, then a slow re-approach that sets the origin.
+// The switch edge is latched by a pin interrupt together with the axis step
+// position, so the origin does not depend on how often loop() runs; the axis
+// then brakes normally and the latched position becomes zero.
+//
+// The seek speed is the fastest the axis can go and still stop within
+// HOMING_OVERSHOOT_INCHES past the switch at its configured acceleration.
+//
+// Step-loss check (homingCheckStart): a rapid move to just outside the
+// switch, then one pass through it at the seek speed. Homing remembers where
+// the seek pass sees the switch relative to the origin, so the difference
+// measured by the check is the drift of the step count. The position is
+// corrected by it and the drift is kept per axis for the trend.
+
+#ifndef HOMING_H
+#define HOMING_H
+
+#include <Arduino.h>
+#include "step_engine.h"
+
+const float HOMING_OVERSHOOT_INCHES = 0.5;   // Allowed run past the switch while braking from seek speed
+const float HOMING_BACKOFF_INCHES = 0.25;    // Clearance before the slow re-approach
+const float HOMING_APPROACH_SPEED = 150;     // Steps/s for the re-approach
+const long HOMING_TRAVEL_LIMIT = 1000000;    // Steps to seek before giving up
+const float HOMING_CHECK_RANGE_INCHES = 0.25;   // Largest drift a check can measure
+const uint8_t HOMING_DRIFT_HISTORY = 8;
+
+struct HomingDrift {
+    uint16_t checks;
+    long last;                               // Steps the count was ahead of the switch
+    long total;                              // Sum, for the mean
+    long worst;                              // Largest magnitude, with its sign
+    long history[HOMING_DRIFT_HISTORY];      // Most recent first
+};
+
+void homingBegin(StepAxis* x, StepAxis* y);  // Home switches on X_HOME_SENSOR_PIN / Y_HOME_SENSOR_PIN
+void homingSetStepsPerInch(float x, float y);   // New calibration, needs a homing before the next check
+void homingStart();
+void homingCheckStart();                     // Measure and correct drift, needs a homing since power-up
+void homingUpdate();                         // Call every loop() pass while homing
+void homingAbort();                          // Drop the sequence, the caller stops the axes
+
+bool homingActive();
+bool homingDone();                           // Both axes homed (or checked)
+bool homingFailed();                         // Switch not found or stuck closed
+bool homingAtSwitches();                     // Both switches found, the rest of homing stays within the overshoot
+bool homingCalibrated();                     // A homing recorded where the seek pass sees the switches
+const HomingDrift& homingDrift(uint8_t axis);   // 0 = X, 1 = Y
+void homingResetDrift();
+
+#endif
@@ -0,0 +1,33 @@
+// Job Stream
+// Spray programs sent line by line from a host over Serial. Lines use the
+// Command opcodes as the wire format (distances in inches, rotation in
+// degrees, spray flag optional):
+//   X<in>[,1]   Y<in>[,1]   R<deg>   S1 / S0   M<x>,<y>,<deg>[,1]
+//   ;comment    END
+// Accepted moves wait in a ring buffer until processStream() hands them to
+// the planner. Flow control is by credits: the host may have at most
+// STREAM_BUFFER_SIZE lines unacknowledged, and every line is answered with
+// exactly one "ok" (or "error: ...") once it has left the buffer, so the
+// buffer can never overflow and the host can keep it full.
+//
+// The same moves can come as binary frames (frame.h), which share the
+// buffer and the credits and are answered with 'K' / 'N' frames instead.
+
+#ifndef JOB_STREAM_H
+#define JOB_STREAM_H
+
+#include <Arduino.h>
+#include "command.h"
+#include "frame.h"
+
+const uint8_t STREAM_BUFFER_SIZE = 32;
+
+void jobStreamBegin();                   // Empty the buffer and announce the credit count
+void jobStreamAbort();                   // Drop buffered moves, no acks are sent for them
+void jobStreamLine(const char* line);    // Parse one received line
+void jobStreamFrame(const Frame& frame); // Decode one move or end frame
+bool jobStreamPop(Command& cmd);         // Next buffered command, acknowledges it
+bool jobStreamFinished();                // END received and the buffer is empty
+uint8_t jobStreamBuffered();
+
+#endif
@@ -0,0 +1,45 @@
+// Line Reader
+// Byte-at-a-time serial line assembly into a fixed static buffer. poll()
+// never waits for data, so a line arriving without its newline can't stall
+// the motion loop the way Serial.readStringUntil() did. Reading stops at
+// FRAME_SYNC, those bytes belong to a binary frame (frame.h). A line longer
+// than the buffer is dropped whole and reported by overflowed(), never run
+// cut short.
+
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <Arduino.h>
+
+const uint8_t LINE_BUFFER_SIZE = 132;    // Longest accepted line, including terminator: W with a 32 byte ssid,
+                                         // 63 byte password and 32 byte token
+const uint8_t LINE_MAX_BYTES_PER_POLL = 32;
+
+class LineReader {
+public:
+    LineReader(Stream& stream);
+
+    // Consume whatever bytes are already waiting. Returns true once a
+    // complete, trimmed, non-empty line is ready in line(), or once a line
+    // that did not fit has ended (overflowed(), line() is then empty).
+    bool poll();
+    bool overflowed() const { return overflow; }
+
+    const char* line() const { return buffer; }
+    uint8_t length() const { return lineLength; }
+
+private:
+    Stream& stream;
+    char buffer[LINE_BUFFER_SIZE];
+    uint8_t fill;
+    uint8_t lineLength;
+    bool discarding;        // Line grew past the buffer, drop bytes until newline
+    bool overflow;          // The ready "line" is one that was dropped
+    bool lineReady;
+};
+
+// Parse up to maxValues comma or space separated numbers from text,
+// returns how many were read
+uint8_t parseNumbers(const char* text, float* values, uint8_t maxValues);
+
+#endif
@@ -0,0 +1,83 @@
+// Motion Planner
+// Look-ahead queue between the pattern executor and the step engine.
+// executeCommand() pushes moves and spray changes here instead of driving
+// the steppers directly; the planner then
+//   - carries speed through consecutive same-direction moves on one axis
+//     (junction speed from a backward pass over the queued blocks),
+//   - starts a move on another axis while the previous one is still in its
+//     deceleration ramp, so step-overs and X reversals round the corner
+//     instead of stopping dead; only where the relay stays shut across the
+//     corner (dry moves, or racetrack passes gated by a spray window), so a
+//     pass never hooks into the step-over,
+//   - ties SPRAY_ON to the start of the following move and SPRAY_OFF to the
+//     end of the preceding one, so the relay switches at exact step positions.
+// Spray lead/lag: the relay can be told to open a given time before a pass
+// starts and close a given time before it ends. The planner turns those times
+// into step distances on the planned profile, so the switch points are still
+// keyed to step position. A pass that starts from rest gets its lead by
+// opening the relay first and holding the move back for the lead time.
+// Spray windows (plannerSprayWindow) gate the relay by X position for
+// racetrack passes: a window starts where X stands when it is reached in the
+// queue, and the valve leads are applied to its edges instead of to moves.
+// Moves queued while the spray is on (after SPRAY_ON, up to SPRAY_OFF) use
+// the axis spray limits, every other move the dry (rapid) limits. Each step
+// engine segment carries its own acceleration, so a pass can hand its speed
+// straight to a rapid move and back without stopping.
+// Dry moves on an axis with a jerk limit (plannerSetJerk) follow an S-curve:
+// the planner splits them into a staircase of constant-acceleration blocks,
+// two per jerk phase at its mean acceleration, which hand their speed to each
+// other like any run of same-axis moves. Moves on an axis with an input
+// shaper (plannerSetShaper), spraying or not, are split the same way into
+// the shaped ramps of shaper.h; the shaper takes precedence over the jerk
+// limit. A valve close lead is counted back through the phases; an opening
+// lead pulled onto the move before only reaches over that move's last phase.
+// Coordinated lines (plannerLine) run on all axes at once and act as a
+// barrier: they start after everything before them has finished.
+
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <Arduino.h>
+#include "step_engine.h"
+#include "shaper.h"
+
+enum PlanAxis {
+    PLAN_AXIS_X,
+    PLAN_AXIS_Y,
+    PLAN_AXIS_R,
+    PLAN_AXIS_COUNT
+};
+
+// Where a job stands, for checkpoints: the tag of the oldest unfinished move,
+// how far along it is, and the positions that correspond to that point
+// (moves blended in after it are not counted).
+struct PlanProgress {
+    uint32_t tag;
+    long stepsDone;
+    long resume[PLAN_AXIS_COUNT];
+};
+
+const uint8_t PLANNER_DEPTH = 42;            // Blocks, 32 commands of look-ahead plus a split move
+const float PLANNER_CORNER_BLEND = 0.5;      // Share of a decel ramp the next axis may overlap (0 = stop at corners)
+
+void plannerBegin(StepAxis* x, StepAxis* y, StepAxis* r);
+void plannerSetLimits(uint8_t axis, float speed, float accel);        // Dry moves, also resets the spray limits
+void plannerSetSprayLimits(uint8_t axis, float speed, float accel);   // Moves made with the spray on
+void plannerSetJerk(uint8_t axis, float jerk);                        // Dry moves, steps/s^3 (0 = trapezoid)
+void plannerSetShaper(uint8_t axis, const Shaper& shaper);            // All moves, pushed afterwards
+void plannerSetSprayLead(float openMs, float closeMs);   // Applies to moves pushed afterwards
+void plannerSetCornerBlend(uint8_t axis, float blend);   // 0..1 of this axis' decel ramp, moves pushed afterwards
+void plannerSetTag(uint32_t tag);                        // Job position carried by moves pushed afterwards
+
+void plannerMove(uint8_t axis, long steps, bool sprayOn);
+void plannerLine(const long steps[PLAN_AXIS_COUNT], bool sprayOn);
+void plannerSpray(bool on);
+void plannerSprayWindow(long width, bool enable);
+
+void plannerUpdate();                        // Call every loop() pass
+void plannerClear();                         // Drop everything queued (axes must be stopped by the caller)
+bool plannerProgress(PlanProgress& progress);           // False when nothing is queued
+bool plannerFull();
+bool plannerIdle();
+
+#endif
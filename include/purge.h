@@ -0,0 +1,36 @@
+// Purge Cycles
+// PRIME (a test spray of paint) and CLEAN (a water flush through the gun) at
+// the purge point in the home corner, which the raster offset keeps clear of
+// the canvas. Neither cycle waits: purgeUpdate() opens the valves on the
+// first pass the head is inside the purge zone and closes them once they
+// have been open for the cycle time, so the gun runs while the head is
+// still homing or braking into the corner instead of after it.
+// The gun is the spray relay; CLEAN also opens the flush valve, which
+// switches the gun's feed from paint to water.
+
+#ifndef PURGE_H
+#define PURGE_H
+
+#include <Arduino.h>
+
+const unsigned long PURGE_PRIME_MS = 3000;
+const unsigned long PURGE_CLEAN_MS = 3000;
+const float PURGE_ZONE_INCHES = 1.0;     // Around the purge point, inside the raster offset
+
+enum PurgeCycle {
+    PURGE_PRIME,
+    PURGE_CLEAN
+};
+
+void purgeBegin(uint8_t flushPin);       // Flush valve, active high
+void purgeStart(PurgeCycle cycle);       // Valves stay shut until the head is in the zone
+void purgeUpdate(bool inZone);           // Call every loop() pass while a cycle runs
+void purgeAbort();                       // Close the valves now
+
+bool purgeActive();                      // Started and not finished
+bool purgeSpraying();                    // Valves open
+bool purgeDone();
+bool purgeInZone(long x, long y);        // Head position in steps from home
+PurgeCycle purgeCycle();
+
+#endif
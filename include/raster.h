@@ -0,0 +1,82 @@
+// Raster Pattern Generator
+// Builds the four side patterns from canvas geometry instead of hand-unrolled
+// tables. Each side is kept as a few step counts and rasterOp() produces the
+// command at a given index on demand, so any canvas size runs in constant
+// memory and a command index stays meaningful for the executor.
+//
+// Each side's rows cover a fixed band of the machine (matching the original
+// tables for a 26" x 35" canvas):
+//   sides 1/2: X from the offset, Y from 0; side 2 is side 1 turned 180
+//   sides 3/4: X from 0, Y from the offset; tray at 270 and 90
+// A side is ROTATE to its tray position, dry X/Y lead-in to its first row,
+// the rows, and a dry lead-out (home, on the last side of a job). Where the
+// rows start, which way they run and the rotations and leads are placed per
+// job by sideOrderPlan(), see side_order.h.
+// Every row is SPRAY_ON, pass (alternating in X), SPRAY_OFF, step-over (no
+// step-over after the last row).
+//
+// Racetrack mode (overtravel > 0) paints on the fly instead: each pass runs
+// past the canvas edges by the overtravel, the step-over happens out there
+// while X reverses, and the relay is gated by a spray window over the canvas
+// rather than switched per row. The rows become one continuous loop:
+//   WINDOW on at the near edge, dry X move to the overtravel start, SPRAY_ON,
+//   long pass, step-over, long pass, ..., SPRAY_OFF, WINDOW off.
+// X cannot travel behind home: sides 1/2 get at most the offset as near-edge
+// overtravel, and sides 3/4 (whose rows start at X = 0) keep classic rows.
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <Arduino.h>
+#include "command.h"
+
+struct CanvasParams {
+    float width;           // Pass length on sides 1/2 (inches)
+    float height;          // Pass length on sides 3/4 (inches)
+    float stepOver12;      // Row spacing on sides 1/2
+    float stepOver34;      // Row spacing on sides 3/4
+    float offset;          // Lead-in from the home corner
+    uint8_t rows12;        // 0 = derive from height / stepOver12
+    uint8_t rows34;        // 0 = derive from width / stepOver34
+    float overtravel;      // Racetrack mode: X run past each canvas edge (0 = stop at the edges)
+};
+
+struct RasterSide {
+    long passSteps;        // X steps per spray pass
+    long stepOverSteps;    // Y steps between rows, sign gives row direction
+    uint8_t rows;
+    bool reversePasses;    // First pass runs -X from the far edge
+    long edgeX;            // Near corner of the band the rows cover
+    long edgeY;
+    long trayAngle;        // Tray position that presents the side, steps from side 1
+    long rotationSteps;    // Tray move before the side
+    long leadInX;          // Dry moves to the first row
+    long leadInY;
+    long leadOutX;         // Dry moves after the last row
+    long leadOutY;
+    long overtravelStart;  // Racetrack overtravel before the near edge (steps, 0 when classic)
+    long overtravelEnd;    // and past the far edge
+};
+
+struct RasterPoint {
+    long x;
+    long y;
+};
+
+const uint8_t RASTER_SIDES = 4;
+extern const CanvasParams DEFAULT_CANVAS;
+
+void rasterConfigure(const CanvasParams& canvas);
+const CanvasParams& rasterCanvas();
+const RasterSide& rasterSide(uint8_t side);
+
+// Head position at the first row and after the last one for a row direction
+RasterPoint rasterEntry(uint8_t side, bool reverseX, bool reverseY);
+RasterPoint rasterExit(uint8_t side, bool reverseX, bool reverseY);
+void rasterOrient(uint8_t side, bool reverseX, bool reverseY);
+void rasterPlace(uint8_t side, long rotation, long leadInX, long leadInY, long leadOutX, long leadOutY);
+
+int rasterLength(uint8_t side);
+PatternOp rasterOp(uint8_t side, int index);
+
+#endif
@@ -0,0 +1,25 @@
+// Rotary Tray
+// The tray axis as a rotary model: the motor's steps per turn and the
+// tray/pulley gear ratio give the steps for one tray turn
+// (ROTATION_STEPS_PER_TURN in config.h). Tray angles are integer steps and
+// the ratio is chosen so quarter turns are exact, so presenting the sides
+// never accumulates rounding. Angles given in degrees (streamed jobs) are
+// converted from an absolute angle in millidegrees, which keeps a run of
+// small relative rotations from drifting either.
+
+#ifndef ROTARY_H
+#define ROTARY_H
+
+#include <Arduino.h>
+#include "config.h"
+
+constexpr long rotaryQuarter(int quarters) {   // Tray position of a quarter turn, steps from side 1
+    return ROTATION_STEPS_PER_TURN * quarters / 4;
+}
+
+long rotaryWrap(long steps);                   // Into 0 .. one turn
+uint8_t rotaryNearestQuarter(long steps);      // Quarter turn the tray is closest to, 0..3
+long rotaryShortest(long from, long to);       // Tray move of at most half a turn, ties turn forward
+long rotaryAngleSteps(long millidegrees);      // Absolute angle to the nearest step
+
+#endif
@@ -0,0 +1,44 @@
+// Task Scheduler
+// Cooperative fixed-priority scheduler for loop(). The firmware's work is
+// split into tasks, registered highest priority first; each pass runs the
+// tasks that are due (every pass, or every periodUs) in that order.
+//
+// Once a pass has spent SCHEDULER_PASS_BUDGET_US, lower-priority tasks that
+// are due are deferred to the next pass, so slow work queues up behind motion
+// instead of delaying it. A task is deferred at most SCHEDULER_MAX_DEFERRALS
+// passes in a row, so none is starved. A run longer than the task's budget
+// counts as an overrun. Step pulses never wait for any of this, they come
+// from the step interrupt.
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+
+const uint8_t SCHEDULER_MAX_TASKS = 8;
+const uint32_t SCHEDULER_PASS_BUDGET_US = 500;
+const uint8_t SCHEDULER_MAX_DEFERRALS = 4;
+
+struct SchedulerTask {
+    const char* name;
+    void (*run)();
+    uint32_t periodUs;         // 0 = every pass
+    uint32_t budgetUs;         // Longest expected run
+};
+
+struct SchedulerStats {
+    uint32_t runs;
+    uint32_t overruns;
+    uint32_t deferrals;
+    uint32_t maxUs;
+    uint32_t totalUs;
+};
+
+bool schedulerAdd(const SchedulerTask& task);   // False when SCHEDULER_MAX_TASKS are registered
+void schedulerRun();                             // One pass, call from loop()
+uint8_t schedulerTaskCount();
+const SchedulerTask& schedulerTask(uint8_t index);
+const SchedulerStats& schedulerStats(uint8_t index);
+void schedulerResetStats();
+
+#endif
@@ -0,0 +1,25 @@
+// Jerk-Limited Profiles
+// Rest-to-rest move with limited jerk: the acceleration ramps up over a jerk
+// phase, holds, ramps back down to the cruise speed, and the stop mirrors it.
+// Short moves reach a lower peak speed (and, if too short for the full
+// acceleration, a lower peak acceleration). With jerk 0 it is the plain
+// trapezoid. Shared by the planner, which runs these profiles as a staircase
+// of constant-acceleration segments, and the estimator.
+
+#ifndef SCURVE_H
+#define SCURVE_H
+
+#include <Arduino.h>
+
+struct SCurve {
+    float peakSpeed;      // Steps/s
+    float peakAccel;      // Steps/s^2
+    float jerkTime;       // Seconds of each jerk phase
+    float accelTime;      // Seconds at peakAccel, per ramp
+    float rampSteps;      // Steps to reach peakSpeed
+    float seconds;        // Whole move
+};
+
+SCurve scurvePlan(float distance, float speed, float accel, float jerk);
+
+#endif
@@ -0,0 +1,76 @@
+// Machine Settings
+// Values that have to outlive a power cycle, each kind in its own data
+// flash blocks (data_flash.h):
+//   SettingsRecord  measured on this machine (the TUNE profile)
+//   ConfigRecord    calibration, motion limits, pin polarity and pattern
+//                   geometry, edited over serial (K) in place of a reflash
+// Records are appended like the checkpoints and the newest valid one of
+// the current version wins. Each kind has two blocks: once one is full the
+// next record goes into the other, and the full one is only erased after
+// that record reads back. A power cut therefore always leaves a valid
+// record, and the machine never drops back to the compiled calibration and
+// relay polarity on its own. A save blocks for a few milliseconds, so it
+// is only done while the machine stands still. Loading is a copy of the
+// record found at startup.
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <Arduino.h>
+
+const uint16_t SETTINGS_VERSION = 1;
+const uint16_t CONFIG_VERSION = 1;
+
+struct SettingsRecord {
+    uint32_t sequence;
+    uint16_t version;          // SETTINGS_VERSION, older records are ignored
+    uint8_t tunedAxes;         // Bit 0 = X, bit 1 = Y: the tuned profile below is set
+    uint8_t reserved;
+    float rapidSpeed[2];       // X, Y steps/s, see autotune.h
+    float accel[2];            // X, Y steps/s^2
+    uint8_t spare[6];
+    uint16_t crc;              // CRC-16/CCITT over everything before it
+};
+
+static_assert(sizeof(SettingsRecord) == 32, "SettingsRecord must fill one flash slot");
+
+// ConfigRecord polarity bits
+const uint8_t CONFIG_INVERT_X = 0x01;       // Direction pins
+const uint8_t CONFIG_INVERT_Y = 0x02;
+const uint8_t CONFIG_INVERT_R = 0x04;
+const uint8_t CONFIG_RELAY_ACTIVE_LOW = 0x08;
+
+struct ConfigRecord {
+    uint32_t sequence;
+    uint16_t version;          // CONFIG_VERSION, older records are ignored
+    uint8_t polarity;          // CONFIG_INVERT_* / CONFIG_RELAY_ACTIVE_LOW
+    uint8_t reserved;
+    int32_t stepsPerInch[2];   // X, Y
+    int32_t speed[3];          // X, Y, R steps/s, moves with the spray on (the tray: all moves)
+    int32_t accel[3];          // Steps/s^2
+    int32_t rapidSpeed[2];     // X, Y dry moves, the base under a TUNE profile
+    int32_t rapidAccel[2];
+    int32_t rotationJerk;      // Steps/s^3, 0 = trapezoid
+    float canvas[6];           // Inches: width, height, stepOver12, stepOver34, offset, overtravel
+    uint8_t rows[2];           // rows12, rows34, 0 = derived
+    uint8_t spare[40];
+    uint16_t crc;              // CRC-16/CCITT over everything before it
+};
+
+static_assert(sizeof(ConfigRecord) == 128, "ConfigRecord must fill one flash slot");
+
+bool settingsBegin();                         // Open the flash and find the newest records
+bool settingsLoad(SettingsRecord& out);       // False if there is none, out is then zeroed
+bool settingsSave(const SettingsRecord& record);
+
+bool configLoad(ConfigRecord& out);           // False if there is none, out is then left as it is
+bool configSave(const ConfigRecord& record);
+
+// ConfigRecord fields by name, for editing over serial
+uint8_t configFieldCount();
+const char* configFieldName(uint8_t field);
+float configFieldValue(const ConfigRecord& record, uint8_t field);
+int configFieldFind(const char* name);        // -1 if there is no such field
+bool configFieldSet(ConfigRecord& record, uint8_t field, float value);   // False when out of range
+
+#endif
@@ -0,0 +1,49 @@
+// Input Shaping
+// The carriage rings at its resonance after every change of acceleration,
+// and at pass ends that shows in the paint. A shaper splits each change into
+// impulses spaced half a ringing period apart whose vibrations cancel: ZV
+// uses two, ZVD three (twice as long, but forgiving of a frequency that is
+// somewhat off). Convolving a trapezoid's constant acceleration with them
+// gives a staircase of constant accelerations again, which the planner runs
+// like its S-curves. Shaping adds the shaper's duration to every move;
+// moves too short to cruise for that long are given a lower peak speed so
+// the shaped ramps never overlap. Shared by the planner and the estimator.
+
+#ifndef SHAPER_H
+#define SHAPER_H
+
+#include <Arduino.h>
+
+enum ShaperType {
+    SHAPER_OFF,
+    SHAPER_ZV,
+    SHAPER_ZVD
+};
+
+const uint8_t SHAPER_MAX_IMPULSES = 3;
+const uint8_t SHAPER_MAX_PHASES = 2 * SHAPER_MAX_IMPULSES - 1;   // Per ramp
+const float SHAPER_MIN_HZ = 5.0;
+const float SHAPER_MAX_HZ = 200.0;
+const float SHAPER_MAX_DAMPING = 0.5;
+
+struct Shaper {
+    uint8_t impulses;                        // 0 or 1 = not shaped
+    float amplitude[SHAPER_MAX_IMPULSES];    // Sums to 1
+    float delay[SHAPER_MAX_IMPULSES];        // Seconds
+};
+
+struct ShapedMove {
+    float peakSpeed;                         // Steps/s
+    uint8_t phases;                          // Of the ramp up; the stop brakes through the same ones
+    float accel[SHAPER_MAX_PHASES];          // Steps/s^2, 0 = holding speed
+    float seconds[SHAPER_MAX_PHASES];
+    float totalSeconds;                      // Whole move
+};
+
+// Resonance frequency in Hz and damping ratio measured on the axis
+Shaper shaperMake(ShaperType type, float frequency, float damping);
+float shaperDuration(const Shaper& shaper);
+bool shaperActive(const Shaper& shaper);
+ShapedMove shaperPlan(const Shaper& shaper, float distance, float speed, float accel);   // Rest to rest
+
+#endif
@@ -0,0 +1,33 @@
+// Side Ordering
+// Plans a pattern job for the selected sides: the order they are painted in,
+// which corner each side's rows start from and which way the tray turns to
+// reach each one (the shorter way, 180 turns go forward). The aim is the
+// least time spent on dry moves between sides and on tray rotations, timed as
+// rest-to-rest moves at each side's axis limits. Spraying time does not
+// depend on the plan.
+//
+// With at most four sides every order and corner is tried (24 x 256). The
+// chosen plan is written into the raster sides (rasterOrient/rasterPlace), so
+// the executor, the estimator and checkpoint resume all replay the same
+// command stream. A job starts at X/Y home with the tray at the quarter turn
+// it was left at (startQuarter, 0 = side 1 facing the head; a tray between
+// quarters is squared up first) and ends back at X/Y home, the tray at the
+// last side's angle. Every tray move in the plan therefore goes to a side's
+// absolute angle (rotaryShortest), the same as touch-up runs.
+
+#ifndef SIDE_ORDER_H
+#define SIDE_ORDER_H
+
+#include <Arduino.h>
+#include "raster.h"
+#include "estimator.h"
+
+void sideOrderPlan(const bool selected[RASTER_SIDES], const AxisMotion motion[RASTER_SIDES][PLAN_AXIS_COUNT],
+                   uint8_t startQuarter);
+uint8_t sideOrderCount();                 // Sides in the planned job
+uint8_t sideOrderSide(uint8_t step);      // Side painted at a job step
+int sideOrderStep(uint8_t side);          // Job step of a side, -1 if not selected
+float sideOrderDrySeconds();              // Dry move and rotation time of the plan
+long sideOrderLoadTurn();                 // Tray move after the last side back to side 1 facing
+
+#endif
@@ -0,0 +1,177 @@
+// Step Engine
+// Generates step pulses for every axis from a fixed-rate hardware timer
+// interrupt (RA4M1 GPT), so motion no longer depends on how long a pass
+// through loop() takes. StepAxis keeps the subset of the AccelStepper API
+// the firmware already uses (move/moveTo/stop/isRunning/...).
+//
+// Besides plain targets, each axis accepts queued segments from the planner.
+// A segment can end at a non-zero exit speed when another segment is queued
+// behind it, and can switch the spray relay when it starts or ends, so relay
+// timing is tied to step position rather than to loop() latency.
+//
+// For racetrack passes the relay can also be gated by a position window on
+// one axis: it only opens while that axis is between the window bounds, no
+// matter where the segments switch it.
+//
+// Coordinated moves (stepEngineLine) run one trapezoid profile on the axis
+// with the most steps and Bresenham-step the others from it, so several axes
+// start and finish together along a straight line.
+//
+// stepEngineHalt() is the emergency stop: the relay is cut and every axis
+// freezes where it is, without braking, until stepEngineRelease(). Queued
+// segments and lines are dropped but not counted as completed, so the
+// planner still reports the move that was running.
+
+#ifndef STEP_ENGINE_H
+#define STEP_ENGINE_H
+
+#include <Arduino.h>
+
+const uint32_t STEP_TICK_HZ = 40000;     // Step interrupt rate, max step rate is half of this
+const uint8_t STEP_IRQ_PRIORITY = 10;    // Lower number = higher priority
+const uint8_t MAX_STEP_AXES = 3;
+const uint8_t SEGMENT_QUEUE_SIZE = 2;    // Segments waiting behind the active one, per axis
+
+// Spray actions carried by a segment
+const int8_t SPRAY_KEEP = -1;
+const int8_t SPRAY_SET_OFF = 0;
+const int8_t SPRAY_SET_ON = 1;
+
+struct FastPin {
+    volatile uint32_t* reg;
+    uint16_t mask;
+    uint8_t pin;
+};
+
+class StepAxis {
+public:
+    StepAxis(uint8_t stepPin, uint8_t dirPin);
+
+    // Motion parameters (steps/s and steps/s^2), same meaning as AccelStepper
+    void setMaxSpeed(float speed);
+    void setAcceleration(float accel);
+    void setPinsInverted(bool directionInvert = false, bool stepInvert = false);
+
+    // Targets, these drop any queued segments
+    void moveTo(long absolute);
+    void move(long relative);
+    void stop();
+    void setCurrentPosition(long position);
+
+    // Queue a planned segment ending at an absolute target. exitSpeed is only
+    // honoured while another segment is queued behind this one. The end spray
+    // action fires once endLeadSteps or fewer remain. accel is the segment's
+    // own acceleration (0 = setAcceleration()). Returns false when the queue
+    // is full.
+    bool queueSegment(long target, float maxSpeed, float exitSpeed,
+                      int8_t startSpray = SPRAY_KEEP, int8_t endSpray = SPRAY_KEEP,
+                      long endLeadSteps = 0, float accel = 0);
+    bool queueFull() const;
+    uint32_t completedSegments() const;  // Count of queued segments that reached their target
+
+    long currentPosition() const;
+    long targetPosition() const;
+    long distanceToGo() const;
+    float speed() const;                 // Current speed in steps/s (signed)
+    float acceleration() const;
+    float maxSpeed() const;
+    bool isRunning() const;
+    bool movingForward() const;          // Direction of the last or current step
+
+    void begin();                        // Configure pins, called by stepEngineBegin()
+    void tick();                         // Called from the step interrupt only
+
+    // Used by coordinated moves from the step interrupt
+    bool setDirection(bool forward);     // Returns true if the direction pin changed
+    void pulseStep();
+    void halt();                         // Stand still at the current position, see stepEngineHalt()
+
+private:
+    struct Segment {
+        int32_t target;
+        uint32_t maxRate;
+        uint32_t exitRate;
+        uint32_t accelRate;              // 0 = baseAccelRate
+        int8_t startSpray;
+        int8_t endSpray;
+        uint32_t endLead;
+    };
+
+    void clearQueue();
+    bool loadNextSegment();
+
+    FastPin stepPin;
+    FastPin dirPin;
+    bool dirInverted;
+    bool stepInverted;
+
+    // Shared with the interrupt
+    volatile int32_t position;
+    volatile int32_t target;
+    volatile uint32_t rate;              // Steps per tick, Q32 fixed point
+    volatile uint32_t maxRate;           // Q32
+    volatile uint32_t exitRate;          // Q32, rate to hand over to the next segment
+    volatile uint32_t accelRate;         // Rate change per tick, Q32
+    volatile uint32_t minRate;           // Crawl rate so a profile never stalls short of target
+    volatile int8_t endSpray;
+    volatile uint32_t endLead;
+    volatile bool segmentActive;
+    volatile uint32_t segmentsDone;
+    Segment queue[SEGMENT_QUEUE_SIZE];
+    volatile uint8_t queueHead;
+    volatile uint8_t queueCount;
+    uint32_t baseMaxRate;                // From setMaxSpeed(), restored for plain targets
+    uint32_t baseAccelRate;              // From setAcceleration(), likewise
+    uint32_t phase;
+    bool forward;
+    bool pulseHigh;
+    bool pinsReady;
+};
+
+bool stepEngineBegin();                  // Start the step timer, false if no GPT channel is free
+void stepEngineTick();                   // Advance every axis by one timer tick
+
+// Interrupt timing, measured with the CPU cycle counter (zero on host builds).
+// A tick is late when it starts more than half a period after the previous
+// one; steps put out on a late tick missed their deadline.
+struct StepTimingStats {
+    uint32_t ticks;
+    uint32_t lateTicks;
+    uint32_t periodCycles;               // Nominal tick period
+    uint32_t maxJitterCycles;            // Worst deviation of a tick interval from the period
+    uint32_t maxTickCycles;              // Longest pass through stepEngineTick()
+    uint32_t lateSteps[MAX_STEP_AXES];   // Per axis, in construction order
+};
+
+void stepEngineTimingStats(StepTimingStats& out);
+void stepEngineResetTiming();
+
+// Spray relay driven from segment boundaries
+void stepEngineAttachSpray(uint8_t pin, bool activeLow);
+void stepEngineSetSpray(bool on);
+bool stepEngineSprayOn();
+bool stepEngineRelayOpen();             // Driven to, after the spray window and halts
+
+// Position gate on the relay. Open/close leads shift the bounds against the
+// direction of travel so the valve delay is absorbed ahead of each edge.
+void stepEngineSetSprayWindow(StepAxis* axis, long from, long to,
+                              long openLeadSteps = 0, long closeLeadSteps = 0);
+void stepEngineClearSprayWindow();
+
+// Coordinated move of several axes. maxSpeed/accel apply to the axis with
+// the most steps. Fails while a line is running or any axis is busy.
+bool stepEngineLine(StepAxis* const lineAxes[], const long steps[], uint8_t count,
+                    float maxSpeed, float accel,
+                    int8_t startSpray = SPRAY_KEEP, int8_t endSpray = SPRAY_KEEP);
+void stepEngineStopLine();              // Decelerate a running line to a stop
+bool stepEngineLineActive();
+uint32_t stepEngineLinesCompleted();
+uint32_t stepEngineLinesStarted();      // Ahead of completed by one while a line runs or brakes
+
+// Emergency stop, safe to call from an interrupt. positions gets every
+// axis's step count, in construction order.
+void stepEngineHalt(long positions[MAX_STEP_AXES]);
+void stepEngineRelease();
+bool stepEngineHalted();
+
+#endif
@@ -0,0 +1,76 @@
+// Network Telemetry
+// Small HTTP service on the UNO R4 WiFi's ESP32-S3 module, so a dashboard can
+// watch several booths and hand them jobs without a PC on each:
+//   GET /status              state, side, command, positions, spray, batch
+//   GET /log                 canvases painted since power-up (newest first)
+//   POST /cmd?token=<token>&line=<command>
+//                            any serial command line (Q13,80,2 / B / P / E ...),
+//                            answered with the status after it, or 409 when
+//                            the machine refuses it (during a streamed job, or W)
+// Responses are JSON and the connection is closed after each one. A request
+// line over 127 bytes, or a command line over 63, gets 414 and runs nothing.
+//
+// Commands start jobs and move the axes, so /cmd only takes POST, with the
+// token shared with the dashboard (-DTELEMETRY_TOKEN=\"...\" or W): a wrong
+// or missing token gets 403, and without a token set every command is
+// refused. There is no CORS header, so pages from other sites cannot read
+// the answers.
+//
+// Every call into WiFiS3 is a round trip over the serial bridge to the
+// module, so telemetryService() makes at most one per pass and only every
+// TELEMETRY_POLL_MS (TELEMETRY_BUSY_POLL_MS while a job runs). A request is
+// read and answered over several passes and the response goes out in one
+// write. WiFi.begin() blocks on the module for up to ~10 s, so (re)connecting
+// only happens while the machine rests (IDLE, HOMED_WAITING, BATCH_WAITING or
+// ERROR, no purge running). Host builds have no network; telemetryHandle()
+// builds the same responses for them.
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+
+const uint16_t TELEMETRY_PORT = 80;
+const unsigned long TELEMETRY_POLL_MS = 20;
+const unsigned long TELEMETRY_BUSY_POLL_MS = 100;
+const unsigned long TELEMETRY_RETRY_MS = 30000;     // Between connection attempts
+const unsigned long TELEMETRY_CLIENT_MS = 2000;     // A request must arrive within this
+const uint8_t TELEMETRY_LOG_SIZE = 8;
+const uint8_t TELEMETRY_COLOR_LENGTH = 15;
+const uint8_t TELEMETRY_TOKEN_LENGTH = 32;
+const uint16_t TELEMETRY_RESPONSE_SIZE = 1024;
+
+struct TelemetryStatus {
+    const char* state;
+    int side;                  // 1-4, 0 when no side is running
+    int command;
+    long position[3];          // X, Y, R steps
+    bool spray;
+    uint16_t batchRemaining;   // Up to BATCH_QUEUE_SIZE x 255
+    const char* color;
+};
+
+struct TelemetryJob {
+    unsigned long finishedAt;  // millis()
+    float seconds;
+    uint8_t sides;             // Bit n = side n + 1
+    uint8_t speedPercent;
+    bool completed;            // False when stopped by E
+    char color[TELEMETRY_COLOR_LENGTH + 1];
+};
+
+typedef bool (*TelemetryCommand)(const char* line, uint8_t length);   // False when refused
+typedef void (*TelemetryStatusFill)(TelemetryStatus& status);
+
+void telemetryBegin(TelemetryCommand runLine, TelemetryStatusFill fillStatus);
+void telemetrySetNetwork(const char* ssid, const char* password);   // Empty ssid turns the service off
+void telemetrySetToken(const char* token);  // For /cmd, empty refuses every command
+bool telemetryHasToken();
+void telemetryService(bool idle);           // Call every loop() pass, idle allows connecting
+bool telemetryConnected();
+void telemetryLogJob(const TelemetryJob& job);
+
+// Response to one request line ("GET /status HTTP/1.1"), returns its length
+uint16_t telemetryHandle(const char* request, char* out, uint16_t size);
+
+#endif
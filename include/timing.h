@@ -0,0 +1,45 @@
+// Loop Timing
+// Counters for chasing motion stutter: loop() period, a histogram of pass
+// time per system state, time spent in the main loop sections, and the step
+// interrupt stats from the step engine. timingDump() writes everything as
+// one binary record so the host can sample it before and after tuning.
+//
+// Record layout (little-endian, no padding):
+//   uint8  magic[2]        0xA5 0x5A
+//   uint8  version         TIMING_REPORT_VERSION
+//   uint8  states, buckets, sections, axes
+//   uint16 length          bytes from magic to checksum inclusive
+//   uint32 loops, loopMinUs, loopMaxUs, loopAvgUs
+//   uint32 sectionTotalUs[sections], sectionMaxUs[sections], sectionCalls[sections]
+//   uint16 passHistogram[states][buckets]       saturating counts
+//   uint32 ticks, lateTicks, periodCycles, maxJitterCycles, maxTickCycles
+//   uint32 lateSteps[axes]
+//   uint8  checksum        sum of all preceding bytes, mod 256
+// Histogram bucket b counts passes shorter than 16 << b us, the last bucket
+// everything longer.
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <Arduino.h>
+
+const uint8_t TIMING_REPORT_VERSION = 1;
+const uint8_t TIMING_MAX_STATES = 16;        // Histogram rows, indexed by SystemState
+const uint8_t TIMING_BUCKETS = 10;           // <16us ... <4096us, then >=4096us
+
+enum TimingSection {
+    TIMING_SERIAL,                           // Polling and handling serial lines
+    TIMING_PATTERN,                          // processPattern() / processStream()
+    TIMING_PLANNER,                          // plannerUpdate()
+    TIMING_NETWORK,                          // telemetryService()
+    TIMING_SECTION_COUNT
+};
+
+void timingLoopStart();                      // First thing in loop()
+void timingLoopEnd(uint8_t state);           // Last thing in loop(), state the pass ran in
+void timingAddSection(uint8_t section, uint32_t elapsedUs);
+
+void timingDump(Print& out);
+void timingReset();                          // Also clears the step interrupt stats
+
+#endif
@@ -0,0 +1,158 @@
+// Cycle-time benchmark
+// Runs the real firmware (setup()/loop(), planner, step engine) against the
+// host mock and reports per side: time, spray-on time and duty, and peak step
+// rate per axis. Each argument is sent as a serial line before the job, so any
+// configuration the firmware accepts can be benchmarked:
+//
+//   .pio/build/native/program C30,40 O4 V1,40,30 13
+//
+// Y steps made while the relay is open are counted as well: a pass must not
+// hook into its step-over, so the run fails if there are any. Valve leads (V)
+// open the relay ahead of a pass on purpose, --spray-y-ok skips the check then.
+//
+// Options: --loop-us N   simulated loop() period (default 250)
+//          --verbose     echo the firmware's serial output
+//          --spray-y-ok  report Y steps with the relay open, do not fail on them
+
+#include <Arduino.h>
+#include "step_engine.h"
+#include "planner.h"
+#include "config.h"
+
+void setup();
+void loop();
+
+extern StepAxis stepperX;
+extern StepAxis stepperY;
+extern StepAxis stepperRotation;
+extern bool sidesToPaint[4];
+
+static const uint32_t TICK_US = 1000000 / STEP_TICK_HZ;
+static const uint64_t TIME_LIMIT_US = 3600ULL * 1000000;
+
+struct SideStats {
+    uint64_t ticks;
+    uint64_t sprayTicks;
+    long sprayY;          // Y steps with the relay open
+    float peak[3];
+};
+
+static uint32_t loopTicks = 10;
+static bool switchState[2] = {false, false};
+
+// Home switches close at or behind the origin, the E-stop contact stays closed
+static int readPin(int pin) {
+    if (pin == ESTOP_PIN) return LOW;    // Contact closed
+    if (pin == X_HOME_SENSOR_PIN) return stepperX.currentPosition() <= 0 ? LOW : HIGH;
+    if (pin == Y_HOME_SENSOR_PIN) return stepperY.currentPosition() <= 0 ? LOW : HIGH;
+    return HIGH;
+}
+
+static void checkSwitch(uint8_t i, int pin) {
+    bool closed = readPin(pin) == LOW;
+    if (closed && !switchState[i] && mock::isr[pin]) mock::isr[pin]();
+    switchState[i] = closed;
+}
+
+static bool sprayOn() {
+    return mock::pins[PAINT_RELAY_PIN] == LOW;   // Relay is active low
+}
+
+static uint64_t tick = 0;
+
+static void step() {
+    mock::micros += TICK_US;
+    stepEngineTick();
+    checkSwitch(0, X_HOME_SENSOR_PIN);
+    checkSwitch(1, Y_HOME_SENSOR_PIN);
+    if (++tick % loopTicks == 0) loop();
+}
+
+// Run until the firmware prints `text`, false on timeout
+static bool runUntil(const char* text, SideStats* sides = nullptr) {
+    size_t from = Serial.output.size();
+    uint64_t start = mock::micros;
+    int side = -1;
+    long lastY = stepperY.currentPosition();
+    while (Serial.output.find(text, from) == std::string::npos) {
+        if (mock::micros - start > TIME_LIMIT_US) return false;
+        step();
+        if (!sides) continue;
+
+        // The side of the oldest move still running, from its planner tag
+        PlanProgress progress;
+        if (plannerProgress(progress)) side = min(progress.tag >> 16, 3u);
+        if (side < 0) continue;
+        SideStats& s = sides[side];
+        s.ticks++;
+        long y = stepperY.currentPosition();
+        if (sprayOn()) {
+            s.sprayTicks++;
+            s.sprayY += labs(y - lastY);
+        }
+        lastY = y;
+        StepAxis* axes[3] = {&stepperX, &stepperY, &stepperRotation};
+        for (uint8_t a = 0; a < 3; a++) {
+            s.peak[a] = max(s.peak[a], fabsf(axes[a]->speed()));
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Serial.echo = false;
+    mock::readPin = readPin;
+    bool sprayYOk = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--verbose")) Serial.echo = true;
+        if (!strcmp(argv[i], "--spray-y-ok")) sprayYOk = true;
+    }
+
+    setup();
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--loop-us") && i + 1 < argc) {
+            loopTicks = max(1, atoi(argv[++i]) / (int)TICK_US);
+        } else if (strcmp(argv[i], "--verbose") && strcmp(argv[i], "--spray-y-ok")) {
+            Serial.send(argv[i]);
+        }
+    }
+    for (int i = 0; i < 100; i++) step();
+
+    uint64_t homingStart = mock::micros;
+    Serial.send("H");
+    if (!runUntil("Homing complete")) {
+        printf("homing did not finish\n");
+        return 1;
+    }
+    float homingSeconds = (mock::micros - homingStart) / 1e6f;
+
+    SideStats sides[4] = {};
+    Serial.send("S");
+    if (!runUntil("Cycle complete", sides)) {
+        printf("cycle did not finish\n");
+        return 1;
+    }
+
+    printf("homing  %7.2f s\n", homingSeconds);
+    printf("side     time s  spray s  duty %%  peak X   peak Y   peak R (steps/s)  spray Y steps\n");
+    uint64_t total = 0;
+    uint64_t totalSpray = 0;
+    long totalSprayY = 0;
+    for (int i = 0; i < 4; i++) {
+        const SideStats& s = sides[i];
+        if (!s.ticks) continue;
+        printf("%d       %7.2f  %7.2f  %6.1f  %7.0f  %7.0f  %7.0f  %16ld\n", i + 1, s.ticks * TICK_US / 1e6,
+               s.sprayTicks * TICK_US / 1e6, 100.0 * s.sprayTicks / s.ticks, s.peak[0], s.peak[1], s.peak[2],
+               s.sprayY);
+        total += s.ticks;
+        totalSpray += s.sprayTicks;
+        totalSprayY += s.sprayY;
+    }
+    printf("total   %7.2f  %7.2f  %6.1f\n", total * TICK_US / 1e6, totalSpray * TICK_US / 1e6,
+           total ? 100.0 * totalSpray / total : 0.0);
+    if (totalSprayY > 0 && !sprayYOk) {
+        printf("Y moved %ld steps with the relay open\n", totalSprayY);
+        return 1;
+    }
+    return 0;
+}
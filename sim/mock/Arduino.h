@@ -0,0 +1,146 @@
+// Host Arduino Mock
+// Just enough of the Arduino core for the firmware to build natively
+// ([env:native] in platformio.ini). Pins are plain arrays, time only moves
+// when the simulator advances mock::micros, interrupts are function pointers
+// the simulator calls itself, and Serial reads from an input queue and
+// writes to stdout and a capture buffer.
+
+#ifndef MOCK_ARDUINO_H
+#define MOCK_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <string>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define DEC 10
+#define HEX 16
+#define PI 3.1415926535897932384626433832795
+
+#define A0 14
+#define A1 15
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+class __FlashStringHelper;
+#define F(x) ((const __FlashStringHelper*)(x))
+
+namespace mock {
+inline int pins[64];                         // Last value written per pin
+inline int (*readPin)(int pin) = nullptr;    // Input model, unset reads HIGH
+inline void (*isr[64])() = {};
+inline uint64_t micros = 0;
+}
+
+inline void pinMode(int, int) {}
+inline void digitalWrite(int pin, int value) { mock::pins[pin & 63] = value; }
+inline int digitalRead(int pin) { return mock::readPin ? mock::readPin(pin) : HIGH; }
+inline int digitalPinToInterrupt(int pin) { return pin; }
+inline void attachInterrupt(int irq, void (*f)(), int) { mock::isr[irq & 63] = f; }
+
+inline unsigned long micros() { return (unsigned long)mock::micros; }
+inline unsigned long millis() { return (unsigned long)(mock::micros / 1000); }
+inline void delay(unsigned long ms) { mock::micros += ms * 1000ULL; }
+inline void noInterrupts() {}
+inline void interrupts() {}
+inline char* ltoa(long value, char* out, int base) {
+    snprintf(out, 34, base == 16 ? "%lx" : "%ld", value);
+    return out;
+}
+
+template<class T, class L> auto min(const T& a, const L& b) -> decltype((b < a) ? b : a) { return (b < a) ? b : a; }
+template<class T, class L> auto max(const T& a, const L& b) -> decltype((b < a) ? b : a) { return (a < b) ? b : a; }
+template<class T, class L, class H> T constrain(T v, L lo, H hi) { return v < lo ? lo : (v > hi ? hi : v); }
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    size_t write(const uint8_t* data, size_t n) {
+        for (size_t i = 0; i < n; i++) write(data[i]);
+        return n;
+    }
+
+    size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t print(const __FlashStringHelper* s) { return print((const char*)s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+    size_t print(int v, int base = DEC) { return print((long)v, base); }
+    size_t print(unsigned int v, int base = DEC) { return print((unsigned long)v, base); }
+    size_t print(long v, int base = DEC) {
+        if (v < 0 && base == DEC) return print('-') + print((unsigned long)-v, base);
+        return print((unsigned long)v, base);
+    }
+    size_t print(unsigned long v, int base = DEC) {
+        char buf[24];
+        snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", v);
+        return print(buf);
+    }
+    size_t print(double v, int digits = 2) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.*f", digits, v);
+        return print(buf);
+    }
+
+    template<class T> size_t println(T v) { return print(v) + println(); }
+    template<class T> size_t println(T v, int format) { return print(v, format) + println(); }
+    size_t println() { return print("\r\n"); }
+    void flush() {}
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream {
+public:
+    std::string input;                       // Bytes the firmware has yet to read
+    std::string output;                      // Everything the firmware printed
+    bool echo = true;                        // Mirror output to stdout
+
+    void begin(unsigned long) {}
+    operator bool() { return true; }
+    int availableForWrite() { return 64; }
+
+    int available() override { return (int)input.size(); }
+    int read() override {
+        if (input.empty()) return -1;
+        int c = (unsigned char)input[0];
+        input.erase(0, 1);
+        return c;
+    }
+    int peek() override { return input.empty() ? -1 : (unsigned char)input[0]; }
+    size_t write(uint8_t c) override {
+        output += (char)c;
+        if (echo) fputc(c, stdout);
+        return 1;
+    }
+    using Print::write;
+
+    // Simulator side
+    void send(const char* line) {
+        input += line;
+        input += '\n';
+    }
+};
+
+inline HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,229 @@
+#include "autotune.h"
+#include "config.h"
+#include "homing.h"
+
+enum TunePhase {
+    TUNE_IDLE,
+    TUNE_MOVING,         // Round trips at the level's limits
+    TUNE_CHECKING,       // Step-loss check at the old limits
+    TUNE_REHOMING,       // Lost more than a check measures, homing again
+    TUNE_DONE,
+    TUNE_FAILED
+};
+
+enum TuneLadder {
+    LADDER_ACCEL,
+    LADDER_SPEED
+};
+
+static StepAxis* tuneAxes[2];
+static TunePhase phase = TUNE_IDLE;
+static TuneResult results[2];
+static float baseSpeed[2];          // First rung of each ladder
+static float baseAccel[2];
+static float priorSpeed[2];         // Axis limits before the tune, homing was calibrated at these
+static float priorAccel[2];
+
+static uint8_t axis = 0;
+static TuneLadder ladder = LADDER_ACCEL;
+static uint8_t level = 0;
+static float trialSpeed = 0;
+static float trialAccel = 0;
+static float lastClean = 0;          // Value of the ladder's last clean level, 0 = none yet
+static long origin = 0;
+static long travel = 0;              // Steps out from origin at this level
+static uint8_t legs = 0;             // Moves finished at this level
+
+static float stepsPerInch() {
+    return axis == 0 ? X_STEPS_PER_INCH : Y_STEPS_PER_INCH;
+}
+
+static void restoreLimits() {
+    for (uint8_t a = 0; a < 2; a++) {
+        tuneAxes[a]->setMaxSpeed(priorSpeed[a]);
+        tuneAxes[a]->setAcceleration(priorAccel[a]);
+    }
+}
+
+// Checks brake from the seek at the acceleration homing planned the overshoot for
+static void checkLimits() {
+    for (uint8_t a = 0; a < 2; a++) {
+        tuneAxes[a]->setMaxSpeed(baseSpeed[a]);
+        tuneAxes[a]->setAcceleration(priorAccel[a]);
+    }
+}
+
+static void finishLadder(bool failed, long drift);
+
+static void startLevel() {
+    float scale = powf(TUNE_STEP, level);
+    if (ladder == LADDER_ACCEL) {
+        trialAccel = baseAccel[axis] * scale;
+        trialSpeed = baseSpeed[axis];
+    } else {
+        trialAccel = results[axis].accel;
+        trialSpeed = min(baseSpeed[axis] * scale, TUNE_MAX_SPEED);
+    }
+    float steps = TUNE_MOVE_INCHES * stepsPerInch();
+    if (ladder == LADDER_SPEED) {
+        // Long enough to cruise at the trial speed, v^2 / a to get there and back down
+        steps = max(steps, trialSpeed * trialSpeed / trialAccel + TUNE_CRUISE_INCHES * stepsPerInch());
+        if (steps > TUNE_MAX_TRAVEL_INCHES * stepsPerInch()) {
+            // No move ever runs this fast
+            finishLadder(false, 0);
+            return;
+        }
+    }
+    travel = lroundf(steps);
+    StepAxis* s = tuneAxes[axis];
+    s->setMaxSpeed(trialSpeed);
+    s->setAcceleration(trialAccel);
+    origin = s->currentPosition();
+    legs = 0;
+    s->moveTo(origin + travel);
+    phase = TUNE_MOVING;
+}
+
+static void startLadder(uint8_t a, TuneLadder l) {
+    axis = a;
+    ladder = l;
+    level = 0;
+    lastClean = 0;
+    startLevel();
+}
+
+// Ladder over, keep the margin below a level that failed
+static void finishLadder(bool failed, long drift) {
+    TuneResult& r = results[axis];
+    float start = ladder == LADDER_ACCEL ? baseAccel[axis] : baseSpeed[axis];
+    float value = lastClean > 0 ? lastClean : start;
+    if (failed) value *= TUNE_MARGIN;
+    if (failed) {
+        r.failDrift = drift;
+        r.limited = true;
+    }
+    if (ladder == LADDER_ACCEL) {
+        r.accel = value;
+        startLadder(axis, LADDER_SPEED);
+    } else {
+        r.speed = value;
+        if (axis == 0) {
+            startLadder(1, LADDER_ACCEL);
+        } else {
+            restoreLimits();
+            phase = TUNE_DONE;
+        }
+    }
+}
+
+static void reportLevel() {
+    Serial.print(axis == 0 ? F("Tune X ") : F("Tune Y "));
+    Serial.print(ladder == LADDER_ACCEL ? F("accel ") : F("speed "));
+    Serial.print(ladder == LADDER_ACCEL ? trialAccel : trialSpeed, 0);
+    Serial.print(F(": "));
+}
+
+// measured is false when the drift was past the check's range
+static void finishLevel(long drift, bool measured) {
+    if (!measured || labs(drift) > TUNE_DRIFT_STEPS) {
+        finishLadder(true, drift);
+        return;
+    }
+    lastClean = ladder == LADDER_ACCEL ? trialAccel : trialSpeed;
+    bool capped = ladder == LADDER_SPEED && trialSpeed >= TUNE_MAX_SPEED;
+    if (++level >= TUNE_LEVELS || capped) {
+        finishLadder(false, 0);
+        return;
+    }
+    startLevel();
+}
+
+void autotuneBegin(StepAxis* x, StepAxis* y) {
+    tuneAxes[0] = x;
+    tuneAxes[1] = y;
+}
+
+void autotuneStart(const float speed[2], const float accel[2]) {
+    for (uint8_t a = 0; a < 2; a++) {
+        baseSpeed[a] = speed[a];
+        baseAccel[a] = accel[a];
+        priorSpeed[a] = tuneAxes[a]->maxSpeed();
+        priorAccel[a] = tuneAxes[a]->acceleration();
+        results[a] = {speed[a], accel[a], 0, false};
+    }
+    startLadder(0, LADDER_ACCEL);
+}
+
+void autotuneUpdate() {
+    switch (phase) {
+        case TUNE_MOVING: {
+            StepAxis* s = tuneAxes[axis];
+            if (s->isRunning()) break;
+            legs++;
+            if (legs < 2 * TUNE_CYCLES) {
+                s->moveTo(legs % 2 ? origin : origin + travel);
+                break;
+            }
+            checkLimits();
+            homingCheckStart();
+            phase = TUNE_CHECKING;
+            break;
+        }
+
+        case TUNE_CHECKING:
+            homingUpdate();
+            if (homingFailed()) {
+                // Too far out for the check, or no switch at all: homing tells them apart
+                homingAbort();
+                reportLevel();
+                Serial.println(F("drift past the check range, homing again"));
+                homingStart();
+                phase = TUNE_REHOMING;
+            } else if (homingDone()) {
+                homingAbort();
+                long drift = homingDrift(axis).last;
+                reportLevel();
+                Serial.print(F("drift "));
+                Serial.println(drift);
+                finishLevel(drift, true);
+            }
+            break;
+
+        case TUNE_REHOMING:
+            homingUpdate();
+            if (homingFailed()) {
+                homingAbort();
+                restoreLimits();
+                phase = TUNE_FAILED;
+            } else if (homingDone()) {
+                homingAbort();
+                finishLevel(0, false);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+void autotuneAbort() {
+    if (phase == TUNE_CHECKING || phase == TUNE_REHOMING) homingAbort();
+    if (autotuneActive()) restoreLimits();
+    phase = TUNE_IDLE;
+}
+
+bool autotuneActive() {
+    return phase == TUNE_MOVING || phase == TUNE_CHECKING || phase == TUNE_REHOMING;
+}
+
+bool autotuneDone() {
+    return phase == TUNE_DONE;
+}
+
+bool autotuneFailed() {
+    return phase == TUNE_FAILED;
+}
+
+const TuneResult& autotuneResult(uint8_t a) {
+    return results[a];
+}
@@ -0,0 +1,53 @@
+#include "batch.h"
+
+static BatchCanvas entries[BATCH_QUEUE_SIZE];
+static uint8_t head = 0;
+static uint8_t count = 0;
+
+bool batchAdd(const BatchCanvas& canvas) {
+    if (canvas.count == 0) return true;
+    if (count > 0) {
+        // Same set-up as the newest entry: just more of it
+        BatchCanvas& last = entries[(head + count - 1) % BATCH_QUEUE_SIZE];
+        if (last.sides == canvas.sides && last.speedPercent == canvas.speedPercent &&
+            last.count + canvas.count <= 255) {
+            last.count += canvas.count;
+            return true;
+        }
+    }
+    if (count >= BATCH_QUEUE_SIZE) return false;
+    entries[(head + count) % BATCH_QUEUE_SIZE] = canvas;
+    count++;
+    return true;
+}
+
+bool batchNext(BatchCanvas& out) {
+    if (count == 0) return false;
+    BatchCanvas& e = entries[head];
+    e.count--;
+    out = e;
+    if (e.count == 0) {
+        head = (head + 1) % BATCH_QUEUE_SIZE;
+        count--;
+    }
+    return true;
+}
+
+uint16_t batchRemaining() {
+    uint16_t total = 0;
+    for (uint8_t i = 0; i < count; i++) total += entries[(head + i) % BATCH_QUEUE_SIZE].count;
+    return total;
+}
+
+uint8_t batchEntries() {
+    return count;
+}
+
+const BatchCanvas& batchEntry(uint8_t index) {
+    return entries[(head + index) % BATCH_QUEUE_SIZE];
+}
+
+void batchClear() {
+    head = 0;
+    count = 0;
+}
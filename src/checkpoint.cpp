@@ -0,0 +1,140 @@
+#include "checkpoint.h"
+#include "crc.h"
+#include "data_flash.h"
+
+static const uint32_t FLASH_SIZE = CONFIG_FLASH_OFFSET;     // Blocks ahead of the configuration
+static const uint32_t BLOCK_SIZE = DATA_FLASH_BLOCK_SIZE;
+static const uint32_t SLOT_SIZE = sizeof(CheckpointRecord);
+static const uint16_t SLOT_COUNT = FLASH_SIZE / SLOT_SIZE;
+static const uint16_t SLOTS_PER_BLOCK = BLOCK_SIZE / SLOT_SIZE;
+static const uint8_t BLOCK_COUNT = SLOT_COUNT / SLOTS_PER_BLOCK;
+static_assert(BLOCK_COUNT <= 8, "Blank blocks are tracked in one byte");
+
+static bool flashReady = false;
+static CheckpointRecord newest;
+static bool haveNewest = false;
+static uint16_t nextSlot = 0;
+static int newestSlot = -1;
+static uint8_t blankBlocks = 0;      // Bit n = block n is erased
+static bool stalled = false;         // A record was refused at a used block start
+
+static CheckpointRecord pending;
+static bool writing = false;
+static uint8_t written = 0;
+
+static uint16_t recordCrc(const CheckpointRecord& r) {
+    return crc16((const uint8_t*)&r, offsetof(CheckpointRecord, crc));
+}
+
+static bool slotBlank(uint16_t slot) {
+    return dataFlashBlank(slot * SLOT_SIZE, SLOT_SIZE);
+}
+
+bool checkpointBegin() {
+    flashReady = dataFlashOpen();
+    if (!flashReady) return false;
+
+    // Newest valid record, then the next slot after it
+    newestSlot = -1;
+    for (uint16_t slot = 0; slot < SLOT_COUNT; slot++) {
+        if (slotBlank(slot)) continue;
+        CheckpointRecord r;
+        dataFlashRead(slot * SLOT_SIZE, &r, SLOT_SIZE);
+        if (r.crc != recordCrc(r)) continue;
+        if (!haveNewest || (int32_t)(r.sequence - newest.sequence) > 0) {
+            newest = r;
+            haveNewest = true;
+            newestSlot = slot;
+        }
+    }
+    nextSlot = (newestSlot + 1) % SLOT_COUNT;
+    blankBlocks = 0;
+    for (uint8_t block = 0; block < BLOCK_COUNT; block++) {
+        if (dataFlashBlank(block * BLOCK_SIZE, BLOCK_SIZE)) blankBlocks |= 1 << block;
+    }
+    return true;
+}
+
+bool checkpointLoad(CheckpointRecord& out) {
+    if (!haveNewest) return false;
+    out = newest;
+    return true;
+}
+
+bool checkpointWrite(const CheckpointRecord& record) {
+    if (!flashReady || writing) return false;
+
+    // Skip slots damaged by a write cut short; a used block start needs an erase first
+    uint16_t tries = SLOTS_PER_BLOCK;
+    while (!slotBlank(nextSlot)) {
+        if (nextSlot % SLOTS_PER_BLOCK == 0 || --tries == 0) {
+            stalled = true;
+            return false;
+        }
+        nextSlot = (nextSlot + 1) % SLOT_COUNT;
+    }
+    stalled = false;
+    blankBlocks &= ~(1 << (nextSlot / SLOTS_PER_BLOCK));
+
+    pending = record;
+    pending.sequence = haveNewest ? newest.sequence + 1 : 1;
+    pending.crc = recordCrc(pending);
+    written = 0;
+    writing = true;
+    return true;
+}
+
+void checkpointService(bool idle) {
+    if (!flashReady) return;
+
+    if (writing) {
+        uint8_t chunk = min((uint32_t)CHECKPOINT_BYTES_PER_SERVICE, SLOT_SIZE - written);
+        if (!dataFlashProgram(nextSlot * SLOT_SIZE + written, (const uint8_t*)&pending + written, chunk)) {
+            // Leave the slot as damaged and try the next one with the next record
+            writing = false;
+            nextSlot = (nextSlot + 1) % SLOT_COUNT;
+            return;
+        }
+        written += chunk;
+        if (written >= SLOT_SIZE) {
+            writing = false;
+            newest = pending;
+            haveNewest = true;
+            newestSlot = nextSlot;
+            nextSlot = (nextSlot + 1) % SLOT_COUNT;
+        }
+        return;
+    }
+
+    if (!idle) return;
+
+    // Erase ahead of the log while nothing moves, one block per pass: every
+    // block but the one holding the newest record, so a whole job fits
+    // before the log comes round to a used block again
+    uint8_t keep = newestSlot >= 0 ? newestSlot / SLOTS_PER_BLOCK : BLOCK_COUNT;
+    for (uint8_t block = 0; block < BLOCK_COUNT; block++) {
+        if (block == keep || (blankBlocks & (1 << block))) continue;
+        if (dataFlashErase(block * BLOCK_SIZE)) blankBlocks |= 1 << block;
+        stalled = false;
+        return;
+    }
+}
+
+bool checkpointStalled() {
+    return stalled;
+}
+
+uint16_t checkpointFreeSlots() {
+    if (!flashReady) return 0;
+    uint16_t free = 0;
+    for (uint16_t n = 0; n < SLOT_COUNT; n++) {
+        uint16_t slot = (nextSlot + n) % SLOT_COUNT;
+        if (slot % SLOTS_PER_BLOCK == 0 && !(blankBlocks & (1 << (slot / SLOTS_PER_BLOCK)))) break;
+        free++;
+    }
+    return free;
+}
+
+bool checkpointBusy() {
+    return writing;
+}
@@ -0,0 +1,160 @@
+#include "coverage.h"
+
+const uint8_t WORD_BITS = 32;
+const uint8_t ROW_WORDS = COVERAGE_CELLS / WORD_BITS;
+static_assert(COVERAGE_CELLS % WORD_BITS == 0, "Rows must fill whole words");
+
+struct SideMap {
+    bool mapped;
+    uint8_t rows;
+    uint8_t skipped;
+    long edgeX;
+    long edgeY;
+    long passSteps;
+    long rowPitch;        // Steps between row lines, always positive
+    uint32_t openLagUs;
+    uint32_t closeLagUs;
+    uint32_t cells[COVERAGE_MAX_ROWS][ROW_WORDS];
+    uint32_t sprayUs[COVERAGE_MAX_ROWS];
+};
+
+static SideMap maps[RASTER_SIDES];
+
+// Previous sample
+static int lastSide = -1;
+static int lastRow = -1;
+static long lastX = 0;
+static bool lastPainting = false;
+static uint32_t lastAt = 0;
+static bool relayWas = false;
+static uint32_t relayChangedAt = 0;
+
+void coverageStart(uint8_t side, const RasterSide& geometry, unsigned openLeadMs, unsigned closeLeadMs) {
+    if (side >= RASTER_SIDES) return;
+    SideMap& m = maps[side];
+    memset(&m, 0, sizeof(m));
+    m.mapped = true;
+    m.rows = min(geometry.rows, COVERAGE_MAX_ROWS);
+    m.skipped = geometry.rows - m.rows;
+    m.edgeX = geometry.edgeX;
+    m.edgeY = geometry.edgeY;
+    m.passSteps = max(geometry.passSteps, 1L);
+    m.rowPitch = labs(geometry.stepOverSteps);
+    m.openLagUs = openLeadMs * 1000UL;
+    m.closeLagUs = closeLeadMs * 1000UL;
+    lastSide = -1;
+}
+
+void coverageClear() {
+    for (uint8_t side = 0; side < RASTER_SIDES; side++) maps[side].mapped = false;
+    lastSide = -1;
+}
+
+// Row whose line the head is on, -1 between rows or off the band
+static int rowAt(const SideMap& m, long y) {
+    long offset = y - m.edgeY;
+    long tolerance = max(m.rowPitch / 4, 1L);
+    long row = m.rowPitch > 0 ? (offset + m.rowPitch / 2) / m.rowPitch : 0;
+    if (offset < -tolerance || row >= m.rows) return -1;
+    return labs(offset - row * m.rowPitch) <= tolerance ? row : -1;
+}
+
+static void setCell(SideMap& m, int row, int cell) {
+    m.cells[row][cell / WORD_BITS] |= 1UL << (cell % WORD_BITS);
+}
+
+// Cells whose centres lie between two head positions
+static void paintSpan(SideMap& m, int row, long from, long to) {
+    if (from > to) {
+        long t = from;
+        from = to;
+        to = t;
+    }
+    float scale = (float)COVERAGE_CELLS / m.passSteps;
+    long first = (long)ceilf((from - m.edgeX) * scale - 0.5f);
+    long last = (long)floorf((to - m.edgeX) * scale - 0.5f);
+    first = max(first, 0L);
+    last = min(last, (long)COVERAGE_CELLS - 1);
+    for (long cell = first; cell <= last; cell++) setCell(m, row, cell);
+}
+
+void coverageUpdate(int side, long x, long y, bool relayOn) {
+    uint32_t now = micros();
+    if (relayOn != relayWas) {
+        relayWas = relayOn;
+        relayChangedAt = now;
+    }
+    if (side < 0 || side >= RASTER_SIDES || !maps[side].mapped) {
+        lastSide = -1;
+        return;
+    }
+    SideMap& m = maps[side];
+    uint32_t since = now - relayChangedAt;
+    bool painting = relayOn ? since >= m.openLagUs : since < m.closeLagUs;
+    int row = rowAt(m, y);
+    if (painting && lastPainting && side == lastSide && row >= 0 && row == lastRow) {
+        paintSpan(m, row, lastX, x);
+        m.sprayUs[row] += now - lastAt;
+    }
+    lastSide = side;
+    lastRow = row;
+    lastX = x;
+    lastPainting = painting;
+    lastAt = now;
+}
+
+bool coverageMapped(uint8_t side) {
+    return side < RASTER_SIDES && maps[side].mapped;
+}
+
+uint8_t coverageRows(uint8_t side) {
+    return coverageMapped(side) ? maps[side].rows : 0;
+}
+
+uint8_t coverageRowsSkipped(uint8_t side) {
+    return coverageMapped(side) ? maps[side].skipped : 0;
+}
+
+bool coverageCell(uint8_t side, uint8_t row, uint8_t cell) {
+    if (row >= coverageRows(side) || cell >= COVERAGE_CELLS) return false;
+    return maps[side].cells[row][cell / WORD_BITS] & (1UL << (cell % WORD_BITS));
+}
+
+float coverageRowSeconds(uint8_t side, uint8_t row) {
+    if (row >= coverageRows(side)) return 0;
+    return maps[side].sprayUs[row] * 1e-6f;
+}
+
+uint16_t coveragePainted(uint8_t side) {
+    uint16_t painted = 0;
+    for (uint8_t row = 0; row < coverageRows(side); row++) {
+        for (uint8_t cell = 0; cell < COVERAGE_CELLS; cell++) painted += coverageCell(side, row, cell);
+    }
+    return painted;
+}
+
+uint16_t coverageGaps(uint8_t side) {
+    uint16_t gaps = 0;
+    uint8_t row = 0;
+    uint8_t cell = 0;
+    CoverageGap gap;
+    while (coverageNextGap(side, row, cell, gap)) gaps++;
+    return gaps;
+}
+
+bool coverageNextGap(uint8_t side, uint8_t& row, uint8_t& cell, CoverageGap& gap) {
+    for (; row < coverageRows(side); row++, cell = 0) {
+        while (cell < COVERAGE_CELLS && coverageCell(side, row, cell)) cell++;
+        if (cell >= COVERAGE_CELLS) continue;
+        uint8_t end = cell;
+        while (end < COVERAGE_CELLS && !coverageCell(side, row, end)) end++;
+        const SideMap& m = maps[side];
+        gap.row = row;
+        gap.fromX = m.edgeX + m.passSteps * cell / COVERAGE_CELLS;
+        gap.toX = m.edgeX + m.passSteps * end / COVERAGE_CELLS;
+        gap.y = m.edgeY + row * m.rowPitch;
+        cell = end;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,70 @@
+#include "data_flash.h"
+
+#if defined(ARDUINO_ARCH_RENESAS)
+#include "r_flash_lp.h"
+
+static flash_lp_instance_ctrl_t flashCtrl;
+static flash_cfg_t flashCfg;
+static const uint32_t FLASH_BASE = BSP_FEATURE_FLASH_DATA_FLASH_START;
+static bool opened = false;
+
+bool dataFlashOpen() {
+    if (opened) return true;
+    memset(&flashCfg, 0, sizeof(flashCfg));
+    flashCfg.data_flash_bgo = false;
+    flashCfg.irq = FSP_INVALID_VECTOR;
+    opened = R_FLASH_LP_Open(&flashCtrl, &flashCfg) == FSP_SUCCESS;
+    return opened;
+}
+
+void dataFlashRead(uint32_t offset, void* out, uint32_t length) {
+    memcpy(out, (const void*)(FLASH_BASE + offset), length);
+}
+
+bool dataFlashProgram(uint32_t offset, const uint8_t* data, uint32_t length) {
+    return R_FLASH_LP_Write(&flashCtrl, (uint32_t)data, FLASH_BASE + offset, length) == FSP_SUCCESS;
+}
+
+bool dataFlashErase(uint32_t offset) {
+    return R_FLASH_LP_Erase(&flashCtrl, FLASH_BASE + offset, 1) == FSP_SUCCESS;
+}
+
+bool dataFlashBlank(uint32_t offset, uint32_t length) {
+    flash_result_t result;
+    if (R_FLASH_LP_BlankCheck(&flashCtrl, FLASH_BASE + offset, length, &result) != FSP_SUCCESS) return false;
+    return result == FLASH_RESULT_BLANK;
+}
+
+#else
+
+static uint8_t hostFlash[DATA_FLASH_SIZE];
+
+bool dataFlashOpen() {
+    static bool erased = false;
+    if (!erased) memset(hostFlash, 0xFF, sizeof(hostFlash));
+    erased = true;
+    return true;
+}
+
+void dataFlashRead(uint32_t offset, void* out, uint32_t length) {
+    memcpy(out, hostFlash + offset, length);
+}
+
+bool dataFlashProgram(uint32_t offset, const uint8_t* data, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) hostFlash[offset + i] &= data[i];
+    return true;
+}
+
+bool dataFlashErase(uint32_t offset) {
+    memset(hostFlash + offset - offset % DATA_FLASH_BLOCK_SIZE, 0xFF, DATA_FLASH_BLOCK_SIZE);
+    return true;
+}
+
+bool dataFlashBlank(uint32_t offset, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        if (hostFlash[offset + i] != 0xFF) return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,183 @@
+#include "estimator.h"
+#include "raster.h"
+#include "scurve.h"
+#include "shaper.h"
+
+// Timeline of the job so far, in seconds from the start
+struct PrevMove {
+    bool axisMove;            // False for barriers (spray windows) and the job start
+    uint8_t axis;
+    float end;
+    float tail;               // Time spent inside its blend window
+    bool sprayHeld;
+    bool windowed;
+};
+
+static float axisEnd[PLAN_AXIS_COUNT];
+static float allEnd = 0;
+static float endBeforePrev = 0;
+static PrevMove prev;
+static long xPosition = 0;
+static bool spraying = false;
+static bool sprayEdge = false;            // Spray switched since the last move
+static bool windowOn = false;
+static long windowFrom = 0;
+static long windowTo = 0;
+
+// Rest-to-rest trapezoid over `distance` steps
+struct Profile {
+    float distance;
+    float accel;
+    float peak;               // Highest speed reached
+    float ramp;               // Steps to reach it
+    float total;              // Seconds for the whole move
+};
+
+static Profile makeProfile(float distance, float speed, float accel) {
+    Profile p;
+    p.distance = distance;
+    p.accel = accel;
+    p.peak = sqrtf(min(speed * speed, accel * distance));
+    p.ramp = p.peak * p.peak / (2.0f * accel);
+    p.total = 2.0f * p.peak / accel + (distance - 2.0f * p.ramp) / p.peak;
+    return p;
+}
+
+// Seconds from the start of the move until `x` steps are done
+static float timeAt(const Profile& p, float x) {
+    if (x <= p.ramp) return sqrtf(2.0f * x / p.accel);
+    if (x >= p.distance - p.ramp) return p.total - sqrtf(2.0f * max(p.distance - x, 0.0f) / p.accel);
+    return p.peak / p.accel + (x - p.ramp) / p.peak;
+}
+
+float estimatorMoveSeconds(long steps, const AxisMotion& motion) {
+    if (steps == 0 || motion.speed <= 0 || motion.accel <= 0) return 0;
+    if (shaperActive(motion.shaper)) return shaperPlan(motion.shaper, labs(steps), motion.speed, motion.accel).totalSeconds;
+    if (motion.jerk > 0) return scurvePlan(labs(steps), motion.speed, motion.accel, motion.jerk).seconds;
+    return makeProfile(labs(steps), motion.speed, motion.accel).total;
+}
+
+void estimatorBegin() {
+    for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) axisEnd[a] = 0;
+    allEnd = 0;
+    endBeforePrev = 0;
+    prev = {false, 0, 0, 0, false, false};
+    xPosition = 0;
+    spraying = false;
+    sprayEdge = false;
+    windowOn = false;
+}
+
+// Spray-on part of an X move from `from` by `steps`, clipped to the window
+static float windowTime(const Profile& p, long from, long steps) {
+    float lo = steps > 0 ? windowFrom - from : from - windowTo;
+    float hi = steps > 0 ? windowTo - from : from - windowFrom;
+    lo = constrain(lo, 0.0f, p.distance);
+    hi = constrain(hi, 0.0f, p.distance);
+    return hi > lo ? timeAt(p, hi) - timeAt(p, lo) : 0;
+}
+
+static void barrier() {
+    endBeforePrev = allEnd;
+    prev = {false, 0, allEnd, 0, false, false};
+}
+
+static float addMove(uint8_t axis, long steps, bool sprayOn, const AxisMotion& m) {
+    if (sprayOn) spraying = true;
+    bool edge = sprayEdge || sprayOn;
+    sprayEdge = false;
+    float speed = spraying ? m.spraySpeed : m.speed;
+    float accel = spraying ? m.sprayAccel : m.accel;
+    if (steps == 0 || speed <= 0 || accel <= 0) return 0;
+
+    Profile p = makeProfile(labs(steps), speed, accel);
+
+    // When the planner lets this move start, blending only where the relay
+    // stays shut (see canBlend() in the planner)
+    bool blend = !edge && prev.sprayHeld == spraying && (!spraying || (prev.windowed && windowOn));
+    float start;
+    if (prev.axisMove && prev.axis == axis) {
+        start = prev.end;
+    } else if (prev.axisMove && blend) {
+        start = max(max(endBeforePrev, prev.end - prev.tail), axisEnd[axis]);
+    } else {
+        start = allEnd;
+    }
+    float total = p.total;
+    bool shaped = shaperActive(m.shaper);
+    bool sCurve = !shaped && !spraying && m.jerk > 0;
+    SCurve c;
+    ShapedMove sm;
+    if (shaped) {
+        sm = shaperPlan(m.shaper, p.distance, speed, accel);
+        total = sm.totalSeconds;
+    } else if (sCurve) {
+        c = scurvePlan(p.distance, speed, accel, m.jerk);
+        total = c.seconds;
+    }
+    float end = start + total;
+
+    float spray = 0;
+    if (spraying) {
+        if (!windowOn) {
+            spray = total;
+        } else if (axis == PLAN_AXIS_X) {
+            spray = windowTime(p, xPosition, steps);
+        } else if (xPosition > windowFrom && xPosition < windowTo) {
+            spray = total;
+        }
+    }
+    if (axis == PLAN_AXIS_X) xPosition += steps;
+
+    // Same blend window as plannerMove()
+    float blendSteps = min(p.ramp * m.blend, p.distance);
+    float tail = blendSteps > 0 ? p.total - timeAt(p, p.distance - blendSteps) : 0;
+    // Split moves: the stop taken as one constant deceleration of its length
+    float stop = 0;
+    if (sCurve) stop = 2.0f * c.jerkTime + c.accelTime;
+    if (shaped) stop = sm.peakSpeed / accel + shaperDuration(m.shaper);
+    if (stop > 0) tail = stop * sqrtf(m.blend);
+
+    endBeforePrev = max(endBeforePrev, prev.end);
+    axisEnd[axis] = end;
+    allEnd = max(allEnd, end);
+    prev = {true, axis, end, tail, spraying, windowOn};
+    return spray;
+}
+
+SideEstimate estimatorSide(uint8_t side, const AxisMotion motion[PLAN_AXIS_COUNT]) {
+    float sideStart = allEnd;
+    float spray = 0;
+
+    int length = rasterLength(side);
+    for (int i = 0; i < length; i++) {
+        PatternOp op = rasterOp(side, i);
+        switch (op.type()) {
+            case 'X':
+                spray += addMove(PLAN_AXIS_X, op.steps(), op.sprayOn(), motion[PLAN_AXIS_X]);
+                break;
+            case 'Y':
+                spray += addMove(PLAN_AXIS_Y, op.steps(), op.sprayOn(), motion[PLAN_AXIS_Y]);
+                break;
+            case 'R':
+                spray += addMove(PLAN_AXIS_R, op.steps(), false, motion[PLAN_AXIS_R]);
+                break;
+            case 'S':
+                spraying = op.sprayOn();
+                sprayEdge = true;
+                break;
+            case 'W':
+                // Starts after everything before it, at the X position reached
+                barrier();
+                windowOn = op.sprayOn() && op.steps() != 0;
+                windowFrom = min(xPosition, xPosition + op.steps());
+                windowTo = max(xPosition, xPosition + op.steps());
+                break;
+        }
+    }
+
+    SideEstimate e;
+    e.seconds = allEnd - sideStart;
+    e.spraySeconds = spray;
+    return e;
+}
@@ -0,0 +1,49 @@
+#include "estop.h"
+
+static uint8_t estopPin = 0;
+static bool attached = false;
+static volatile bool tripped = false;
+static long positions[MAX_STEP_AXES];
+static volatile uint32_t trippedAt = 0;
+
+static void trip() {
+    if (tripped) return;
+    stepEngineHalt(positions);
+    trippedAt = micros();
+    tripped = true;
+}
+
+void estopBegin(uint8_t pin) {
+    estopPin = pin;
+    attached = true;
+    pinMode(estopPin, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(estopPin), trip, RISING);
+    if (estopInputOpen()) trip();
+}
+
+void estopPoll() {
+    if (!tripped && estopInputOpen()) trip();
+}
+
+bool estopTripped() {
+    return tripped;
+}
+
+bool estopInputOpen() {
+    return attached && digitalRead(estopPin) == HIGH;
+}
+
+bool estopReset() {
+    if (estopInputOpen()) return false;
+    tripped = false;
+    stepEngineRelease();
+    return true;
+}
+
+const long* estopPositions() {
+    return positions;
+}
+
+uint32_t estopTrippedAt() {
+    return trippedAt;
+}
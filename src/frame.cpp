@@ -0,0 +1,120 @@
+#include "frame.h"
+#include "crc.h"
+
+FrameReader::FrameReader(Stream& s)
+    : stream(s), fill(0), receivedCrc(0), inFrame(false), resyncing(false), lastByteAt(0) {
+    current.opcode = 0;
+    current.length = 0;
+    current.payload[0] = 0;
+}
+
+static uint16_t frameCrc(const Frame& f) {
+    uint8_t header[2] = {f.length, f.opcode};
+    return crc16(f.payload, f.length, crc16(header, 2));
+}
+
+FramePoll FrameReader::poll() {
+    if ((inFrame || resyncing) && stream.available() == 0 && millis() - lastByteAt > FRAME_TIMEOUT_MS) {
+        // Link went quiet, text may follow again
+        resyncing = false;
+        if (inFrame) {
+            // Host stopped part way
+            inFrame = false;
+            return FRAME_BAD;
+        }
+    }
+
+    uint8_t budget = FRAME_MAX_BYTES_PER_POLL;
+    while (budget-- > 0 && stream.available() > 0) {
+        if (!inFrame) {
+            if (stream.peek() != FRAME_SYNC) {
+                if (!resyncing) return FRAME_NONE;
+                // Rest of a dropped frame
+                stream.read();
+                lastByteAt = millis();
+                continue;
+            }
+            stream.read();
+            resyncing = false;
+            inFrame = true;
+            fill = 0;
+            lastByteAt = millis();
+            continue;
+        }
+
+        int c = stream.read();
+        if (c < 0) break;
+        lastByteAt = millis();
+
+        // length, opcode, payload, crc low, crc high
+        if (fill == 0) {
+            if (c > FRAME_MAX_PAYLOAD) {
+                inFrame = false;
+                resyncing = true;
+                return FRAME_BAD;
+            }
+            current.length = c;
+        } else if (fill == 1) {
+            current.opcode = c;
+        } else if (fill < 2 + current.length) {
+            current.payload[fill - 2] = c;
+        } else if (fill == 2 + current.length) {
+            receivedCrc = c;
+        } else {
+            receivedCrc |= (uint16_t)c << 8;
+            inFrame = false;
+            if (receivedCrc != frameCrc(current)) {
+                resyncing = true;
+                return FRAME_BAD;
+            }
+            current.payload[current.length] = 0;
+            return FRAME_READY;
+        }
+        fill++;
+    }
+    return FRAME_NONE;
+}
+
+int32_t frameInt32(const Frame& frame, uint8_t offset) {
+    if (offset + 4 > frame.length) return 0;
+    const uint8_t* p = frame.payload + offset;
+    return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+uint16_t frameUint16(const Frame& frame, uint8_t offset) {
+    if (offset + 2 > frame.length) return 0;
+    return frame.payload[offset] | (uint16_t)frame.payload[offset + 1] << 8;
+}
+
+void framePutInt32(uint8_t* out, int32_t value) {
+    framePutUint16(out, (uint32_t)value & 0xFFFF);
+    framePutUint16(out + 2, (uint32_t)value >> 16);
+}
+
+void framePutUint16(uint8_t* out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+void frameSend(Print& out, uint8_t opcode, const uint8_t* payload, uint8_t length) {
+    Frame f;
+    f.opcode = opcode;
+    f.length = min(length, FRAME_MAX_PAYLOAD);
+    memcpy(f.payload, payload, f.length);
+    uint16_t crc = frameCrc(f);
+
+    uint8_t header[3] = {FRAME_SYNC, f.length, opcode};
+    out.write(header, 3);
+    out.write(f.payload, f.length);
+    uint8_t trailer[2] = {(uint8_t)(crc & 0xFF), (uint8_t)(crc >> 8)};
+    out.write(trailer, 2);
+}
+
+void frameSendText(Print& out, uint8_t opcode, const char* text) {
+    frameSend(out, opcode, (const uint8_t*)text, min(strlen(text), (size_t)FRAME_MAX_PAYLOAD));
+}
+
+long frameMilsToSteps(int32_t mils, long stepsPerInch) {
+    int64_t scaled = (int64_t)mils * stepsPerInch;
+    return (long)((scaled + (scaled >= 0 ? 500 : -500)) / 1000);
+}
@@ -0,0 +1,280 @@
+#include "homing.h"
+#include "config.h"
+
+enum HomePhase {
+    HOME_IDLE,
+    HOME_CLEAR,          // Started on the switch, moving clear for a seek pass
+    HOME_CHECK_RAPID,    // Step-loss check: to just outside the switch
+    HOME_SEEK,
+    HOME_SEEK_STOP,      // Switch hit, braking from seek speed
+    HOME_BACKOFF,
+    HOME_APPROACH,
+    HOME_APPROACH_STOP,
+    HOME_DONE,
+    HOME_FAILED
+};
+
+struct HomeAxis {
+    StepAxis* axis;
+    uint8_t pin;
+    float stepsPerInch;
+    float savedMaxSpeed;
+    HomePhase phase;
+    bool checking;           // Step-loss check rather than homing
+    bool calibrated;
+    float seekSpeed;
+    long seekEdge;           // Where the seek pass saw the switch, relative to the origin
+    long latchedAt;          // Seek pass edge of the homing in progress
+    bool latchedAtSpeed;     // Switch closed at full seek speed, the edge can be a reference
+    volatile bool armed;
+    volatile bool latched;
+    volatile long edge;      // Step position where the switch closed
+    volatile float edgeSpeed;
+};
+
+static HomeAxis homeAxes[2];
+static HomingDrift drift[2];
+
+// Switches are active low with pull-ups, so the closing edge is FALLING
+static void latchEdge(HomeAxis& h) {
+    if (!h.armed || digitalRead(h.pin) != LOW) return;
+    h.edge = h.axis->currentPosition();
+    h.edgeSpeed = fabsf(h.axis->speed());
+    h.latched = true;
+    h.armed = false;
+}
+
+static void xSwitchIsr() {
+    latchEdge(homeAxes[0]);
+}
+
+static void ySwitchIsr() {
+    latchEdge(homeAxes[1]);
+}
+
+static void arm(HomeAxis& h) {
+    noInterrupts();
+    h.latched = false;
+    h.armed = true;
+    interrupts();
+}
+
+static bool switchClosed(const HomeAxis& h) {
+    return digitalRead(h.pin) == LOW;
+}
+
+static void fail(HomeAxis& h) {
+    h.armed = false;
+    h.axis->stop();
+    h.axis->setMaxSpeed(h.savedMaxSpeed);
+    h.phase = HOME_FAILED;
+}
+
+void homingBegin(StepAxis* x, StepAxis* y) {
+    homeAxes[0] = {x, (uint8_t)X_HOME_SENSOR_PIN, (float)X_STEPS_PER_INCH, 0, HOME_IDLE, false, false, 0, 0, 0, false, false, false, 0, 0};
+    homeAxes[1] = {y, (uint8_t)Y_HOME_SENSOR_PIN, (float)Y_STEPS_PER_INCH, 0, HOME_IDLE, false, false, 0, 0, 0, false, false, false, 0, 0};
+    pinMode(X_HOME_SENSOR_PIN, INPUT_PULLUP);
+    pinMode(Y_HOME_SENSOR_PIN, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(X_HOME_SENSOR_PIN), xSwitchIsr, FALLING);
+    attachInterrupt(digitalPinToInterrupt(Y_HOME_SENSOR_PIN), ySwitchIsr, FALLING);
+}
+
+void homingSetStepsPerInch(float x, float y) {
+    homeAxes[0].stepsPerInch = x;
+    homeAxes[1].stepsPerInch = y;
+    // The seek pass edges were recorded in the old steps
+    homeAxes[0].calibrated = false;
+    homeAxes[1].calibrated = false;
+}
+
+static void startSeek(HomeAxis& h, long limit) {
+    h.axis->setMaxSpeed(h.seekSpeed);
+    arm(h);
+    h.axis->moveTo(limit);
+    h.phase = HOME_SEEK;
+}
+
+void homingStart() {
+    for (HomeAxis& h : homeAxes) {
+        h.savedMaxSpeed = h.axis->maxSpeed();
+        h.checking = false;
+        h.latchedAtSpeed = false;
+        // Fastest speed that still stops within the overshoot: v = sqrt(2 a d)
+        float overshoot = HOMING_OVERSHOOT_INCHES * h.stepsPerInch;
+        h.seekSpeed = max(sqrtf(2.0f * h.axis->acceleration() * overshoot), HOMING_APPROACH_SPEED);
+        if (switchClosed(h)) {
+            // Already on the switch, clear it by enough to seek back at full speed
+            h.axis->move((long)((HOMING_OVERSHOOT_INCHES + HOMING_BACKOFF_INCHES) * h.stepsPerInch));
+            h.phase = HOME_CLEAR;
+            continue;
+        }
+        startSeek(h, h.axis->currentPosition() - HOMING_TRAVEL_LIMIT);
+    }
+}
+
+void homingCheckStart() {
+    for (HomeAxis& h : homeAxes) {
+        h.savedMaxSpeed = h.axis->maxSpeed();
+        h.checking = true;
+        if (!h.calibrated) {
+            h.phase = HOME_FAILED;
+            continue;
+        }
+        // Far enough out to be at seek speed when the switch closes
+        float overshoot = HOMING_OVERSHOOT_INCHES * h.stepsPerInch;
+        float range = HOMING_CHECK_RANGE_INCHES * h.stepsPerInch;
+        h.axis->moveTo(h.seekEdge + (long)(overshoot + range));
+        h.phase = HOME_CHECK_RAPID;
+    }
+}
+
+static void recordDrift(uint8_t axis, long steps) {
+    HomingDrift& d = drift[axis];
+    for (uint8_t i = HOMING_DRIFT_HISTORY - 1; i > 0; i--) d.history[i] = d.history[i - 1];
+    d.history[0] = steps;
+    d.last = steps;
+    d.total += steps;
+    if (labs(steps) >= labs(d.worst)) d.worst = steps;
+    if (d.checks < 0xFFFF) d.checks++;
+}
+
+static void updateAxis(HomeAxis& h) {
+    long backoff = (long)(HOMING_BACKOFF_INCHES * h.stepsPerInch);
+    long range = (long)(HOMING_CHECK_RANGE_INCHES * h.stepsPerInch);
+
+    switch (h.phase) {
+        case HOME_CLEAR:
+            if (h.axis->isRunning()) break;
+            if (switchClosed(h)) {
+                fail(h);
+                break;
+            }
+            startSeek(h, h.axis->currentPosition() - HOMING_TRAVEL_LIMIT);
+            break;
+
+        case HOME_CHECK_RAPID:
+            if (h.axis->isRunning()) break;
+            if (switchClosed(h)) {
+                // Drifted further than the check can measure
+                fail(h);
+                break;
+            }
+            startSeek(h, h.seekEdge - range - (long)(HOMING_OVERSHOOT_INCHES * h.stepsPerInch));
+            break;
+
+        case HOME_SEEK:
+            if (h.latched) {
+                h.axis->stop();
+                h.phase = HOME_SEEK_STOP;
+            } else if (!h.axis->isRunning()) {
+                fail(h);
+            }
+            break;
+
+        case HOME_SEEK_STOP:
+            if (h.axis->isRunning()) break;
+            if (h.checking) {
+                // The count is ahead of the switch by the drift, take it back out
+                long steps = h.edge - h.seekEdge;
+                recordDrift(&h - homeAxes, steps);
+                h.axis->setCurrentPosition(h.axis->currentPosition() - steps);
+                h.axis->setMaxSpeed(h.savedMaxSpeed);
+                h.phase = HOME_DONE;
+                break;
+            }
+            // Only a pass at full seek speed is a reference for checks
+            h.latchedAt = h.edge;
+            h.latchedAtSpeed = h.edgeSpeed >= 0.9f * h.seekSpeed;
+            h.axis->moveTo(h.edge + backoff);
+            h.phase = HOME_BACKOFF;
+            break;
+
+        case HOME_BACKOFF:
+            if (h.axis->isRunning()) break;
+            if (switchClosed(h)) {
+                fail(h);
+                break;
+            }
+            h.axis->setMaxSpeed(HOMING_APPROACH_SPEED);
+            arm(h);
+            h.axis->move(-3 * backoff);
+            h.phase = HOME_APPROACH;
+            break;
+
+        case HOME_APPROACH:
+            if (h.latched) {
+                h.axis->stop();
+                h.phase = HOME_APPROACH_STOP;
+            } else if (!h.axis->isRunning()) {
+                fail(h);
+            }
+            break;
+
+        case HOME_APPROACH_STOP:
+            if (!h.axis->isRunning()) {
+                // The latched edge becomes the origin
+                h.axis->setCurrentPosition(h.axis->currentPosition() - h.edge);
+                if (h.latchedAtSpeed) {
+                    h.seekEdge = h.latchedAt - h.edge;
+                    h.calibrated = true;
+                }
+                h.axis->setMaxSpeed(h.savedMaxSpeed);
+                h.phase = HOME_DONE;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+void homingUpdate() {
+    for (HomeAxis& h : homeAxes) {
+        updateAxis(h);
+    }
+}
+
+void homingAbort() {
+    for (HomeAxis& h : homeAxes) {
+        if (h.phase == HOME_IDLE) continue;
+        h.armed = false;
+        if (h.phase != HOME_DONE && h.phase != HOME_FAILED) {
+            h.axis->setMaxSpeed(h.savedMaxSpeed);
+        }
+        h.phase = HOME_IDLE;
+    }
+}
+
+bool homingActive() {
+    for (const HomeAxis& h : homeAxes) {
+        if (h.phase != HOME_IDLE && h.phase != HOME_DONE && h.phase != HOME_FAILED) return true;
+    }
+    return false;
+}
+
+bool homingDone() {
+    return homeAxes[0].phase == HOME_DONE && homeAxes[1].phase == HOME_DONE;
+}
+
+bool homingAtSwitches() {
+    for (const HomeAxis& h : homeAxes) {
+        if (h.checking || h.phase < HOME_SEEK_STOP || h.phase == HOME_FAILED) return false;
+    }
+    return true;
+}
+
+bool homingFailed() {
+    return homeAxes[0].phase == HOME_FAILED || homeAxes[1].phase == HOME_FAILED;
+}
+
+bool homingCalibrated() {
+    return homeAxes[0].calibrated && homeAxes[1].calibrated;
+}
+
+const HomingDrift& homingDrift(uint8_t axis) {
+    return drift[axis < 2 ? axis : 0];
+}
+
+void homingResetDrift() {
+    memset(drift, 0, sizeof(drift));
+}
@@ -0,0 +1,182 @@
+#include "job_stream.h"
+#include "config.h"
+#include "rotary.h"
+#include "line_reader.h"
+#include "frame.h"
+
+static Command ring[STREAM_BUFFER_SIZE];
+static bool ringFramed[STREAM_BUFFER_SIZE];   // Acknowledge with a frame, not "ok"
+static uint8_t ringHead = 0;
+static uint8_t ringCount = 0;
+static bool endReceived = false;
+static long trayAngle = 0;          // Millidegrees from the job start, accepted lines only
+static long parsedAngle = 0;        // After the line being parsed
+
+void jobStreamBegin() {
+    ringHead = 0;
+    ringCount = 0;
+    endReceived = false;
+    trayAngle = 0;
+    Serial.print(F("stream ready "));
+    Serial.println(STREAM_BUFFER_SIZE);
+}
+
+void jobStreamAbort() {
+    ringHead = 0;
+    ringCount = 0;
+    endReceived = false;
+}
+
+static void reject(const __FlashStringHelper* reason, bool framed) {
+    if (framed) {
+        frameSendText(Serial, FRAME_REJECT, (const char*)reason);
+        return;
+    }
+    Serial.print(F("error: "));
+    Serial.println(reason);
+}
+
+static void acknowledge(bool framed) {
+    if (framed) frameSend(Serial, FRAME_ACK, nullptr, 0);
+    else Serial.println(F("ok"));
+}
+
+// Relative rotation taken from the absolute angle, so rounding never adds up
+static long rotationSteps(long millidegrees) {
+    parsedAngle = trayAngle + millidegrees;
+    return rotaryAngleSteps(parsedAngle) - rotaryAngleSteps(trayAngle);
+}
+
+static bool parseCommand(const char* line, Command& cmd) {
+    float v[4];
+    parsedAngle = trayAngle;
+    uint8_t n = parseNumbers(line + 1, v, 4);
+    bool spray;
+
+    switch (toupper(line[0])) {
+        case 'X':
+        case 'Y':
+            if (n < 1) return false;
+            spray = n > 1 && v[1] != 0;
+            cmd = toupper(line[0]) == 'X'
+                ? Command('X', toSteps(v[0], X_STEPS_PER_INCH), spray)
+                : Command('Y', toSteps(v[0], Y_STEPS_PER_INCH), spray);
+            return true;
+
+        case 'R':
+            if (n < 1) return false;
+            cmd = Command('R', rotationSteps(lroundf(v[0] * 1000.0f)), false);
+            return true;
+
+        case 'S':
+            if (n < 1) return false;
+            cmd = Command('S', 0, v[0] != 0);
+            return true;
+
+        case 'M':
+            if (n < 3) return false;
+            cmd = Command(toSteps(v[0], X_STEPS_PER_INCH), toSteps(v[1], Y_STEPS_PER_INCH),
+                          rotationSteps(lroundf(v[2] * 1000.0f)), n > 3 && v[3] != 0);
+            return true;
+    }
+    return false;
+}
+
+// Same fields as the text lines, in fixed point, see frame.h
+static bool decodeFrame(const Frame& f, Command& cmd) {
+    parsedAngle = trayAngle;
+    switch (f.opcode) {
+        case 'X':
+        case 'Y':
+            if (f.length < 5) return false;
+            cmd = Command(f.opcode, frameMilsToSteps(frameInt32(f, 0),
+                          f.opcode == 'X' ? X_STEPS_PER_INCH : Y_STEPS_PER_INCH), f.payload[4] != 0);
+            return true;
+
+        case 'R':
+            if (f.length < 4) return false;
+            cmd = Command('R', rotationSteps(frameInt32(f, 0)), false);
+            return true;
+
+        case 'S':
+            if (f.length < 1) return false;
+            cmd = Command('S', 0, f.payload[0] != 0);
+            return true;
+
+        case 'M':
+            if (f.length < 13) return false;
+            cmd = Command(frameMilsToSteps(frameInt32(f, 0), X_STEPS_PER_INCH),
+                          frameMilsToSteps(frameInt32(f, 4), Y_STEPS_PER_INCH),
+                          rotationSteps(frameInt32(f, 8)), f.payload[12] != 0);
+            return true;
+    }
+    return false;
+}
+
+static void accept(const Command& cmd, bool framed) {
+    if (endReceived) {
+        reject(F("job already ended"), framed);
+        return;
+    }
+    if (ringCount >= STREAM_BUFFER_SIZE) {
+        // Host sent more than its credits allow
+        reject(F("buffer full"), framed);
+        return;
+    }
+    uint8_t slot = (ringHead + ringCount) % STREAM_BUFFER_SIZE;
+    ring[slot] = cmd;
+    ringFramed[slot] = framed;
+    ringCount++;
+    trayAngle = parsedAngle;
+}
+
+void jobStreamLine(const char* line) {
+    if (line[0] == ';') {
+        acknowledge(false);
+        return;
+    }
+    if (strcasecmp(line, "END") == 0) {
+        endReceived = true;
+        acknowledge(false);
+        return;
+    }
+
+    Command cmd;
+    if (!endReceived && !parseCommand(line, cmd)) {
+        reject(F("bad line"), false);
+        return;
+    }
+    accept(cmd, false);
+}
+
+void jobStreamFrame(const Frame& frame) {
+    if (frame.opcode == FRAME_END) {
+        endReceived = true;
+        acknowledge(true);
+        return;
+    }
+
+    Command cmd;
+    if (!endReceived && !decodeFrame(frame, cmd)) {
+        reject(F("bad frame"), true);
+        return;
+    }
+    accept(cmd, true);
+}
+
+bool jobStreamPop(Command& cmd) {
+    if (ringCount == 0) return false;
+    cmd = ring[ringHead];
+    acknowledge(ringFramed[ringHead]);
+    ringHead = (ringHead + 1) % STREAM_BUFFER_SIZE;
+    ringCount--;
+    return true;
+}
+
+bool jobStreamFinished() {
+    return endReceived && ringCount == 0;
+}
+
+uint8_t jobStreamBuffered() {
+    return ringCount;
+}
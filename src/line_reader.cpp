@@ -0,0 +1,75 @@
+#include "line_reader.h"
+#include "frame.h"
+
+LineReader::LineReader(Stream& s)
+    : stream(s), fill(0), lineLength(0), discarding(false), overflow(false), lineReady(false) {
+    buffer[0] = '\0';
+}
+
+bool LineReader::poll() {
+    if (lineReady) {
+        // Previous line has been handled, start the next one
+        lineReady = false;
+        overflow = false;
+        lineLength = 0;
+        fill = 0;
+        buffer[0] = '\0';
+    }
+
+    uint8_t budget = LINE_MAX_BYTES_PER_POLL;
+    while (budget-- > 0 && stream.available() > 0) {
+        // Binary frames are left for the FrameReader, a line can carry on after one
+        if (stream.peek() == FRAME_SYNC) break;
+        int c = stream.read();
+        if (c < 0) break;
+
+        if (c == '\n' || c == '\r') {
+            if (discarding) {
+                discarding = false;
+                fill = 0;
+                buffer[0] = '\0';
+                overflow = true;
+                lineReady = true;
+                return true;
+            }
+
+            // Trim surrounding whitespace in place
+            uint8_t start = 0;
+            while (start < fill && isspace((unsigned char)buffer[start])) start++;
+            uint8_t end = fill;
+            while (end > start && isspace((unsigned char)buffer[end - 1])) end--;
+            if (end == start) {
+                fill = 0;
+                continue;
+            }
+            if (start > 0) memmove(buffer, buffer + start, end - start);
+            lineLength = end - start;
+            buffer[lineLength] = '\0';
+            lineReady = true;
+            return true;
+        }
+
+        if (discarding) continue;
+        if (fill >= LINE_BUFFER_SIZE - 1) {
+            discarding = true;
+            continue;
+        }
+        buffer[fill++] = (char)c;
+    }
+    return false;
+}
+
+uint8_t parseNumbers(const char* text, float* values, uint8_t maxValues) {
+    uint8_t n = 0;
+    const char* c = text;
+    while (n < maxValues) {
+        while (*c == ' ' || *c == ',' || *c == '\t') c++;
+        if (*c == '\0') break;
+        char* end;
+        double v = strtod(c, &end);
+        if (end == c) break;
+        values[n++] = (float)v;
+        c = end;
+    }
+    return n;
+}
@@ -4,6 +4,7 @@
 // HOME = "home"                    # Return paint head to origin position (0,0)
 // PRIME = "prime"                  # Prime paint gun (3-second test spray off-canvas)
 // CLEAN = "clean"                  # Flush paint gun (3-second water cycle)
+//                                 # (PRIME / CLEAN, see purge.h)
 
 // ### Paint Operations ###
 // START_FULL = "start_full"        # Execute complete painting sequence
@@ -26,508 +27,1951 @@
 
 // ### Future Integration ###
 // WEBSITE_UPDATE = "update"        # Auto-sync painted colors to tracking website
-//                                 # (Feature in development)
+//                                 # (the job log at GET /log, see telemetry.h)
 
 // # Usage Examples:
 // # run_command(HOME)              # Return paint head to starting position
 // # run_command(RUN_SIDES, "13")   # Execute painting sequence for sides 1 and 3
 // # run_command(SPEED_SIDE_1, 75)  # Set paint head speed to 75% for side 1
 
-#include <AccelStepper.h>
-#include <Bounce2.h>
-
-// Pin Definitions
-const int X_STEP_PIN = 5;
-const int X_DIR_PIN = 6;
-const int Y_STEP_PIN = 11;
-const int Y_DIR_PIN = 10;
-const int ROTATION_STEP_PIN = A1;
-const int ROTATION_DIR_PIN = A0;
-const int PAINT_RELAY_PIN = 4;
-const int X_HOME_SENSOR_PIN = 12;
-const int Y_HOME_SENSOR_PIN = 8;
-
-// System Configuration
-const int X_STEPS_PER_INCH = 127;    // X-axis calibration
-const int Y_STEPS_PER_INCH = 169;    // Y-axis calibration (adjust as needed)
-const int STEPS_PER_ROTATION = 800;  
+#include "step_engine.h"
+#include "line_reader.h"
+#include "frame.h"
+#include "planner.h"
+#include "command.h"
+#include "config.h"
+#include "raster.h"
+#include "job_stream.h"
+#include "homing.h"
+#include "timing.h"
+#include "estimator.h"
+#include "shaper.h"
+#include "checkpoint.h"
+#include "side_order.h"
+#include "batch.h"
+#include "telemetry.h"
+#include "scheduler.h"
+#include "purge.h"
+#include "estop.h"
+#include "autotune.h"
+#include "settings.h"
+#include "coverage.h"
+#include "rotary.h"
+
+// Calibration
+int X_STEPS_PER_INCH = 127;
+int Y_STEPS_PER_INCH = 169;
+
+// Motion Limits
 int X_SPEED = 5000;      
 int Y_SPEED = 5000;      
-int ROTATION_SPEED = 1000;
+int ROTATION_SPEED = 3000;
 int X_ACCEL = 20000;     
 int Y_ACCEL = 5000;    
-int ROTATION_ACCEL = 200;
+int ROTATION_ACCEL = 4000;
+int ROTATION_JERK = 40000;   // Steps/s^3, S-curve for the tray's inertia (0 = trapezoid)
+
+// Rapid traverse for dry moves: what the drive train manages, not a painting speed
+int RAPID_X_SPEED = 8000;
+int RAPID_Y_SPEED = 6000;
+int RAPID_X_ACCEL = 30000;
+int RAPID_Y_ACCEL = 10000;
+int JOB_SPEED_PERCENT = 100;   // X/Y speed scale for pattern jobs, set per batch canvas
+
+// The configured limits, for an axis without a tuned profile
+struct AxisDefaults {
+    int spraySpeed;
+    int sprayAccel;
+    int rapidSpeed;
+    int rapidAccel;
+};
+AxisDefaults AXIS_DEFAULTS[2];
+
+// Machine configuration, see settings.h: the values above as compiled, the
+// one running, and K edits waiting for KW
+const uint8_t COMPILED_POLARITY = CONFIG_INVERT_X | CONFIG_RELAY_ACTIVE_LOW;
+ConfigRecord COMPILED_CONFIG;
+ConfigRecord machineConfig;
+ConfigRecord stagedConfig;
+bool configStaged = false;
+
+// Paint head motion per side: speed of moves with the spray on (% of the
+// X/Y limits), speed of dry moves (% of the rapid limits), and acceleration
+// for both. The tray always uses its own limits.
+struct MotionProfile {
+    uint8_t sprayPercent;
+    uint8_t travelPercent;
+    uint8_t accelPercent;
+};
+MotionProfile SIDE_PROFILES[4] = {{100, 100, 100}, {100, 100, 100}, {100, 100, 100}, {100, 100, 100}};
+
+// Input shaping against carriage ringing, X and Y: the ringing frequency
+// and damping ratio measured on the axis, see shaper.h
+struct AxisShaping {
+    uint8_t type;              // ShaperType
+    float frequency;           // Hz
+    float damping;
+};
+AxisShaping AXIS_SHAPING[2] = {{SHAPER_OFF, 40, 0.1}, {SHAPER_OFF, 40, 0.1}};
+int motionSide = -2;           // Side whose profile the planner has, -2 = none
+
+// Spray valve latency calibration per side (ms): how far ahead of the
+// commanded point the relay opens at a pass start and closes at a pass end
+int SPRAY_OPEN_LEAD_MS[4] = {0, 0, 0, 0};
+int SPRAY_CLOSE_LEAD_MS[4] = {0, 0, 0, 0};
+float SPRAY_FLOW_ML_PER_MIN = 0;     // Gun flow rate for paint estimates, 0 = unknown
 
 // Forward declarations
-class Command;
 void executeCommand(const Command& cmd);
 void processPattern();
-
-// Command Structure
-class Command {
-public:
-    char type;      // 'X' for X move, 'Y' for Y move, 'R' for rotate, 'S' for spray
-    float value;    // Distance in inches or degrees for rotation
-    bool sprayOn;   // Whether spray should be on during movement
-    
-    Command(char t, float v, bool s) : type(t), value(v), sprayOn(s) {}
-};
-
-// Command Creation Macros
-#define MOVE_X(dist, spray) Command('X', dist, spray)
-#define MOVE_Y(dist, spray) Command('Y', dist, spray)
-#define ROTATE(deg) Command('R', deg, false)
-#define SPRAY_ON() Command('S', 0, true)
-#define SPRAY_OFF() Command('S', 0, false)
+void processStream();
+void printEstimate();
+void startResume();
+void pauseJob();
+void printDrift();
+void planJob(uint8_t startQuarter);
+void applySide(int side);
+void parseProfile(const char* input);
+void parseShaping(const char* input);
+void printProfiles();
+void printShaping();
+void nextBatchCanvas();
+void printBatch();
+void parseBatch(const char* input);
+void startPattern();
+void startBatchCanvas();
+void beginResume();
+void queueCheckpoint(uint8_t status);
+void planCheckpoints();
+bool jobRunning();
+void handleSerialLine(const char* input, uint8_t length);
+bool handleNetworkLine(const char* input, uint8_t length);
+void fillTelemetry(TelemetryStatus& status);
+void logJob(bool completed);
+void motionTask();
+void safetyTask();
+void commandTask();
+void persistenceTask();
+void telemetryTask();
+void printTasks();
+void handleFrame(const Frame& frame);
+void sendStatusFrame();
+void startPurge(PurgeCycle cycle);
+void processPurge();
+void stopMachine();
+void startTune();
+void finishTune();
+void applyTuning(const SettingsRecord& settings);
+int tagSide(uint32_t tag);
+void printCoverage(const char* input);
+void compiledConfig(ConfigRecord& c);
+void applyConfig(const ConfigRecord& c);
+CanvasParams configCanvas(const ConfigRecord& c);
+void parseConfig(const char* input);
+void printConfig();
+void startTouchUp();
+void processTouchUp();
 
 // State Management
 enum SystemState {
     IDLE,
-    HOMING_X,
-    HOMING_Y,
+    HOMING,           // X and Y home together, see homing.h
     HOMED_WAITING,    // New state for waiting after homing
     EXECUTING_PATTERN,
+    STREAMING_JOB,    // Moves arrive over Serial, see job_stream.h
     ERROR,
-    CYCLE_COMPLETE
+    CYCLE_COMPLETE,
+    PAUSED,           // Pattern job stopped by P, G carries on from the same point
+    BATCH_WAITING,    // Batch canvas done, N once the next one is loaded
+    CHECKING_HOME,    // Step-loss check against the home switches between sides
+    PRIMING,          // PRIME / CLEAN at the purge point, homing or moving there at the same time
+    CLEANING,
+    TUNING,           // Speed / acceleration ladders against the home switches, see autotune.h
+    TOUCHING_UP       // Repainting what the coverage map missed, see coverage.h
+};
+
+const char* const STATE_NAMES[] = {
+    "IDLE", "HOMING", "HOMED_WAITING", "EXECUTING_PATTERN", "STREAMING_JOB", "ERROR",
+    "CYCLE_COMPLETE", "PAUSED", "BATCH_WAITING", "CHECKING_HOME", "PRIMING", "CLEANING",
+    "TUNING", "TOUCHING_UP"
 };
 
 // Global Variables
 SystemState systemState = IDLE;
 bool motorsRunning = false;
+int currentStep = 0;      // Position in the planned side order, see side_order.h
 int currentSide = 0;
 int currentCommand = 0;
 bool sidesToPaint[4] = {true, true, true, true}; // Array to track which sides to paint
+uint8_t jobStartQuarter = 0;     // Tray quarter turn the planned job starts from, see side_order.h
+
+// Checkpoints, see checkpoint.h
+const uint32_t NO_CHECKPOINT_TAG = 0xFFFFFFFF;   // Planner tag for moves that are not part of the pattern
+CheckpointRecord checkpointQueued;
+bool checkpointQueuedValid = false;
+bool checkpointStallReported = false;
+unsigned long lastCheckpointAt = 0;
+unsigned long checkpointInterval = CHECKPOINT_INTERVAL_MS;   // Stretched so the whole job fits the log
+CheckpointRecord resumeRecord;
+bool resumePending = false;       // Re-homing before a resume
+uint32_t resumeTag = NO_CHECKPOINT_TAG;
+long resumeOffset = 0;            // Steps of the resumed command done before the stop
+const uint32_t TOUCHUP_TAG = 0xFFFE0000;         // Touch-up moves carry this | side
+
+// Touch-up runs, see coverage.h
+uint8_t touchSide = 0;            // Side whose gaps are queued next
+uint8_t touchRow = 0;
+uint8_t touchCell = 0;
+long touchAt[PLAN_AXIS_COUNT];    // Head position after what is queued
+Command touchMoves[7];            // The gap being queued
+uint8_t touchMoveCount = 0;
+uint8_t touchMoveNext = 0;
+
+// Batch runs, see batch.h
+bool batchRunning = false;
+bool batchLoaded = false;         // Next canvas is on the tray (N came during homing)
+uint8_t canvasesSinceHome = 0;
+
+// Step-loss checks between sides, see homingCheckStart()
+bool homeCheckEnabled = false;
+bool homeCheckDue = false;        // Side finished, check once the axes stop
+long homeCheckReturn[2];          // X, Y to go back to afterwards
+float homeCheckSpeed[2];
+
+// Job log for the telemetry service, see telemetry.h
+char jobColor[TELEMETRY_COLOR_LENGTH + 1] = "";   // Label for the canvases painted next
+bool jobActive = false;           // A pattern job has started and not been logged
+unsigned long jobStartedAt = 0;
+
+bool estopHandled = false;        // Trip reported and the job stopped, see estop.h
+
+// Prime / clean cycles, see purge.h
+bool purgeHoming = false;         // Homing runs under the cycle
+bool startAfterPurge = false;     // S came during the prime
+
+// Status frames for a host on the binary link, see frame.h
+unsigned long statusFramePeriod = 0;   // ms, 0 = only when asked
+unsigned long lastStatusFrame = 0;
 
 
 // Initialize Hardware
-AccelStepper stepperX(AccelStepper::DRIVER, X_STEP_PIN, X_DIR_PIN);
-AccelStepper stepperY(AccelStepper::DRIVER, Y_STEP_PIN, Y_DIR_PIN);
-AccelStepper stepperRotation(AccelStepper::DRIVER, ROTATION_STEP_PIN, ROTATION_DIR_PIN);
-Bounce xHomeSensor = Bounce();
-Bounce yHomeSensor = Bounce();
-
-
-
-
-/*
- * CNC Paint Gun Movement Program
- * Symbol Legend:
- * → = Right movement
- * ← = Left movement
- * ● = Spray On
- * ○ = Spray Off
- * ↑ = Positive Y
- * ↓ = Negative Y
- */
-
-Command SIDE1_PATTERN[] = {
-    // Initial Movement
-    MOVE_X(4.5, false),     // →3.5→ - Initial offset
-
-    // Row 1
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(26, true),      // →26→ - Move right with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(4.16, false),   // ↑4.16↑ - Move up
-
-    // Row 2
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(-26, true),     // ←26← - Move left with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(4.16, false),   // ↑4.16↑ - Move up
-
-    // Row 3
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(26, true),      // →26→ - Move right with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(4.16, false),   // ↑4.16↑ - Move up
-
-    // Row 4
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(-26, true),     // ←26← - Move left with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(4.16, false),   // ↑4.16↑ - Move up
-
-    // Row 5
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(26, true),      // →26→ - Move right with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(4.16, false),   // ↑4.16↑ - Move up
-
-    // Row 6
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(-26, true),     // ←26← - Move left with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(4.16, false),   // ↑4.16↑ - Move up
-
-    // Row 7
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(26, true),      // →26→ - Move right with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(4.16, false),   // ↑4.16↑ - Move up
-
-    // Row 8
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(-26, true),     // ←26← - Move left with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-
-    // Rotation
-    ROTATE(180)            // Rotate tray 180 degrees
-};
+StepAxis stepperX(X_STEP_PIN, X_DIR_PIN);
+StepAxis stepperY(Y_STEP_PIN, Y_DIR_PIN);
+StepAxis stepperRotation(ROTATION_STEP_PIN, ROTATION_DIR_PIN);
+LineReader serialReader(Serial);
+FrameReader frameReader(Serial);
 
-Command SIDE2_PATTERN[] = {
-    // Row 1
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(26, true),      // →26→ - Move right with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(-4.16, false),  // ↓4.16↓ - Move down
-
-    // Row 2
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(-26, true),     // ←26← - Move left with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(-4.16, false),  // ↓4.16↓ - Move down
-
-    // Row 3
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(26, true),      // →26→ - Move right with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(-4.16, false),  // ↓4.16↓ - Move down
-
-    // Row 4
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(-26, true),     // ←26← - Move left with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(-4.16, false),  // ↓4.16↓ - Move down
-
-    // Row 5
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(26, true),      // →26→ - Move right with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(-4.16, false),  // ↓4.16↓ - Move down
-
-    // Row 6
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(-26, true),     // ←26← - Move left with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(-4.16, false),  // ↓4.16↓ - Move down
-
-    // Row 7
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(26, true),      // →26→ - Move right with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-    MOVE_Y(-4.16, false),  // ↓4.16↓ - Move down
-
-    // Row 8
-    SPRAY_ON(),            // ● - Start spray
-    MOVE_X(-26, true),     // ←26← - Move left with spray
-    SPRAY_OFF(),           // ○ - Stop spray
-
-    // Final movement and rotation
-    MOVE_X(-4.5, false), // ←3.5← Return to start
-    ROTATE(90)             // Rotate tray 90 degrees
-};
 
-Command SIDE3_PATTERN[] = {
-    // Initial Movement
-    MOVE_Y(4.5, false),     // ↑3.5↑ Initial offset
-
-    // Row 1
-    SPRAY_ON(),             // ● - Start spray
-    MOVE_X(35, true),       // →35→ - Move right with spray
-    SPRAY_OFF(),            // ○ - Stop spray
-    MOVE_Y(4.415, false),   // ↑4.415↑ - Move up
-
-    // Row 2
-    SPRAY_ON(),             // ● - Start spray
-    MOVE_X(-35, true),      // ←35← - Move left with spray
-    SPRAY_OFF(),            // ○ - Stop spray
-    MOVE_Y(4.415, false),   // ↑4.415↑ - Move up
-
-    // Row 3
-    SPRAY_ON(),             // ● - Start spray
-    MOVE_X(35, true),       // →35→ - Move right with spray
-    SPRAY_OFF(),            // ○ - Stop spray
-    MOVE_Y(4.415, false),   // ↑4.415↑ - Move up
-
-    // Row 4
-    SPRAY_ON(),             // ● - Start spray
-    MOVE_X(-35, true),      // ←35← - Move left with spray
-    SPRAY_OFF(),            // ○ - Stop spray
-    MOVE_Y(4.415, false),   // ↑4.415↑ - Move up
-
-    // Row 5
-    SPRAY_ON(),             // ● - Start spray
-    MOVE_X(35, true),       // →35→ - Move right with spray
-    SPRAY_OFF(),            // ○ - Stop spray
-    MOVE_Y(4.415, false),   // ↑4.415↑ - Move up
-
-    // Row 6
-    SPRAY_ON(),             // ● - Start spray
-    MOVE_X(-35, true),      // ←35← - Move left with spray
-    SPRAY_OFF(),            // ○ - Stop spray
-
-    // Rotation
-    ROTATE(180)             // Rotate tray 180 degrees
-};
 
-Command SIDE4_PATTERN[] = {
-    // Row 1
-    SPRAY_ON(),             // ● - Start spray
-    MOVE_X(35, true),       // →35→ - Move right with spray
-    SPRAY_OFF(),            // ○ - Stop spray
-    MOVE_Y(-4.415, false),  // ↓4.415↓ - Move down
-
-    // Row 2
-    SPRAY_ON(),             // ● - Start spray
-    MOVE_X(-35, true),      // ←35← - Move left with spray
-    SPRAY_OFF(),            // ○ - Stop spray
-    MOVE_Y(-4.415, false),  // ↓4.415↓ - Move down
-
-    // Row 3
-    SPRAY_ON(),             // ● - Start spray
-    MOVE_X(35, true),       // →35→ - Move right with spray
-    SPRAY_OFF(),            // ○ - Stop spray
-    MOVE_Y(-4.415, false),  // ↓4.415↓ - Move down
-
-    // Row 4
-    SPRAY_ON(),             // ● - Start spray
-    MOVE_X(-35, true),      // ←35← - Move left with spray
-    SPRAY_OFF(),            // ○ - Stop spray
-    MOVE_Y(-4.415, false),  // ↓4.415↓ - Move down
-
-    // Row 5
-    SPRAY_ON(),             // ● - Start spray
-    MOVE_X(35, true),       // →35→ - Move right with spray
-    SPRAY_OFF(),            // ○ - Stop spray
-    MOVE_Y(-4.415, false),  // ↓4.415↓ - Move down
-
-    // Row 6
-    SPRAY_ON(),             // ● - Start spray
-    MOVE_X(-35, true),      // ←35← - Move left with spray
-    SPRAY_OFF(),            // ○ - Stop spray
-
-    // Final movement
-    MOVE_Y(-4.5, false)   // ↓3.5↓ Return to start
-};
-
-// Pattern Sizes
-const int SIDE1_SIZE = sizeof(SIDE1_PATTERN) / sizeof(Command);
-const int SIDE2_SIZE = sizeof(SIDE2_PATTERN) / sizeof(Command);
-const int SIDE3_SIZE = sizeof(SIDE3_PATTERN) / sizeof(Command);
-const int SIDE4_SIZE = sizeof(SIDE4_PATTERN) / sizeof(Command);
 
+// Side patterns are generated from the canvas geometry, see raster.h
 
+// Hands the command to the look-ahead planner, which decides when it
+// actually reaches the steppers
 void executeCommand(const Command& cmd) {
     switch(cmd.type) {
         case 'X':
-            if(cmd.sprayOn) digitalWrite(PAINT_RELAY_PIN, LOW);
-            stepperX.move(cmd.value * X_STEPS_PER_INCH);  // Use X-specific calibration
+            plannerMove(PLAN_AXIS_X, cmd.steps, cmd.sprayOn);
             break;
             
         case 'Y':
-            if(cmd.sprayOn) digitalWrite(PAINT_RELAY_PIN, LOW);
-            stepperY.move(cmd.value * Y_STEPS_PER_INCH);  // Use Y-specific calibration
+            plannerMove(PLAN_AXIS_Y, cmd.steps, cmd.sprayOn);
             break;
             
         case 'R':
-            stepperRotation.move((cmd.value * 5000) / 360);
+            plannerMove(PLAN_AXIS_R, cmd.steps, false);
             break;
             
         case 'S':
-            digitalWrite(PAINT_RELAY_PIN, cmd.sprayOn ? LOW : HIGH);
+            plannerSpray(cmd.sprayOn);
+            break;
+            
+        case 'W':
+            plannerSprayWindow(cmd.steps, cmd.sprayOn);
+            break;
+            
+        case 'M': {
+            long steps[PLAN_AXIS_COUNT];
+            steps[PLAN_AXIS_X] = cmd.steps;
+            steps[PLAN_AXIS_Y] = cmd.stepsY;
+            steps[PLAN_AXIS_R] = cmd.stepsR;
+            plannerLine(steps, cmd.sprayOn);
             break;
+        }
     }
 }
 
 void setup() {
-    Serial.begin(115200);
-    
-    pinMode(PAINT_RELAY_PIN, OUTPUT);
-    digitalWrite(PAINT_RELAY_PIN, HIGH);
+    Serial.begin(SERIAL_BAUD);
     
-    pinMode(X_HOME_SENSOR_PIN, INPUT_PULLUP);
-    pinMode(Y_HOME_SENSOR_PIN, INPUT_PULLUP);
+    // Saved configuration over the compiled one, read before the relay pin is driven
+    compiledConfig(COMPILED_CONFIG);
+    ConfigRecord config = COMPILED_CONFIG;
+    bool settingsReady = settingsBegin();
+    bool configured = settingsReady && configLoad(config);
     
-    xHomeSensor.attach(X_HOME_SENSOR_PIN);
-    yHomeSensor.attach(Y_HOME_SENSOR_PIN);
-    xHomeSensor.interval(10);
-    yHomeSensor.interval(10);
+    stepEngineAttachSpray(PAINT_RELAY_PIN, config.polarity & CONFIG_RELAY_ACTIVE_LOW);
+    if (ESTOP_ENABLED) {
+        estopBegin(ESTOP_PIN);
+        if (estopTripped()) {
+            Serial.print(F("E-stop contact open on pin "));
+            Serial.print(ESTOP_PIN);
+            Serial.println(F(": check the switch and its wiring, then R"));
+        }
+    }
     
     stepperX.setMaxSpeed(500);
-    stepperX.setAcceleration(X_ACCEL);
-    stepperX.setPinsInverted(true);
-    
     stepperY.setMaxSpeed(500);
-    stepperY.setAcceleration(Y_ACCEL);
-    stepperY.setPinsInverted(false);
     
-    stepperRotation.setMaxSpeed(ROTATION_SPEED);
-    stepperRotation.setAcceleration(ROTATION_ACCEL);
+    plannerBegin(&stepperX, &stepperY, &stepperRotation);
+    homingBegin(&stepperX, &stepperY);
+    purgeBegin(FLUSH_VALVE_PIN);
+    autotuneBegin(&stepperX, &stepperY);
+    
+    // Also puts the tuned X/Y profile from an earlier TUNE over the limits
+    applyConfig(config);
+    SettingsRecord settings;
+    if (!settingsReady) {
+        Serial.println(F("Settings flash unavailable"));
+    } else {
+        if (configured) Serial.println(F("Saved configuration loaded"));
+        if (settingsLoad(settings) && settings.tunedAxes) Serial.println(F("Tuned motion profile loaded"));
+    }
+    
+    CheckpointRecord last;
+    if (!checkpointBegin()) {
+        Serial.println(F("Checkpoint flash unavailable"));
+    } else if (checkpointLoad(last) && last.status == CHECKPOINT_STATUS_ACTIVE) {
+        Serial.print(F("Unfinished job on side "));
+        Serial.print(last.side + 1);
+        Serial.println(F(", G to resume"));
+    }
+    telemetryBegin(handleNetworkLine, fillTelemetry);
+    
+    // Highest priority first, see scheduler.h
+    schedulerAdd({"motion", motionTask, 0, 400});
+    schedulerAdd({"safety", safetyTask, 0, 50});
+    schedulerAdd({"command", commandTask, 0, 500});
+    schedulerAdd({"persistence", persistenceTask, 1000, 300});
+    schedulerAdd({"telemetry", telemetryTask, 0, 3000});
+    
+    // Step pulses come from the GPT interrupt from here on
+    if (!stepEngineBegin()) {
+        Serial.println(F("Step timer unavailable"));
+        systemState = ERROR;
+    }
     
     Serial.println(F("CNC Paint Sprayer Ready"));
     Serial.println(F("Commands:"));
     Serial.println(F("H - Home"));
+    Serial.println(F("PRIME / CLEAN - Test spray / water flush at the home corner (homes first from idle)"));
+    Serial.println(F("TUNE - Find and save the fastest X/Y profile without step loss, TUNE0 - Forget it"));
+    Serial.println(F("TOUCHUP - Repaint only what the coverage map shows was missed (after homing)"));
     Serial.println(F("S - Start"));
-    Serial.println(F("E - Stop"));
-    Serial.println(F("R - Reset"));
+    Serial.println(F("J - Stream a job from the host (END to finish)"));
+    Serial.println(F("E - Stop (the E-stop input halts at once), R - Reset once released"));
     Serial.println(F("12/13/14/23/24/34 etc. - Select sides to paint"));
+    Serial.println(F("Cw,h[,so12,so34,offset,rows12,rows34] - Set canvas size (inches)"));
+    Serial.println(F("V[side,openMs,closeMs] - Spray valve lead per side"));
+    Serial.println(F("O<inches> - Racetrack overtravel past the canvas edges (O0 = stop at edges)"));
+    Serial.println(F("D - Dump timing counters (binary), D0 - Clear them"));
+    Serial.println(F("U - Task run times and overruns, U0 - Clear them"));
+    Serial.println(F("T - Estimate cycle time for the selected sides"));
+    Serial.println(F("F<ml/min> - Spray flow rate for paint estimates"));
+    Serial.println(F("P - Pause the job, G - Resume it"));
+    Serial.println(F("M - Spray coverage per side, M<side> - Rows of a side, M0 - Clear"));
+    Serial.println(F("K - Configuration, K<name>=<value>[,...] - Change it, KW - Save and apply, KX - Drop, K0 - Compiled"));
+    Serial.println(F("A<side>,<spray%>[,travel%,accel%] - Side motion profile, A - Show"));
+    Serial.println(F("IX/IY<0|1|2>[,Hz,damping] - Input shaping off/ZV/ZVD against carriage ringing, I - Show"));
+    Serial.println(F("Q<sides>[,speed%,count] - Queue canvases, Q - Show, Q0 - Clear"));
+    Serial.println(F("B - Run the batch queue, N - Next canvas is loaded"));
+    Serial.println(F("G - Re-home and resume the job stopped by E or a power loss"));
+    Serial.println(F("Z1/Z0 - Check for lost steps at the home switches between sides, Z - Drift"));
+    Serial.println(F("L<color> - Label the canvases painted next (job log)"));
+    Serial.println(F("W<ssid>,<password>[,<token>] - WiFi for the status and job service, token for its commands"));
+    Serial.println(F("Binary frames (moves, commands, status) can be mixed in, see frame.h"));
 }
 
-void parseSideSelection(String input) {
+void parseSideSelection(const char* input) {
     // Reset all sides to false
     for (int i = 0; i < 4; i++) {
         sidesToPaint[i] = false;
     }
     
     // Parse each character and set corresponding sides
-    for (int i = 0; i < input.length(); i++) {
-        int side = input.charAt(i) - '0';
+    for (const char* c = input; *c; c++) {
+        int side = *c - '0';
         if (side >= 1 && side <= 4) {
             sidesToPaint[side-1] = true;
         }
     }
 }
 
-void processPattern() {
+void printCanvas() {
+    const CanvasParams& c = rasterCanvas();
+    Serial.print(F("Canvas "));
+    Serial.print(c.width);
+    Serial.print(F(" x "));
+    Serial.print(c.height);
+    Serial.print(F(" in, rows "));
+    Serial.print(rasterSide(0).rows);
+    Serial.print(F("/"));
+    Serial.print(rasterSide(2).rows);
+    if (c.overtravel > 0) {
+        Serial.print(F(", racetrack overtravel "));
+        Serial.print(c.overtravel);
+        Serial.print(F(" in"));
+    }
+    Serial.println();
+}
 
+// Canvas, profile and shaper edits rebuild or re-time every side, so they
+// wait until no job is between sides, paused or touching up
+bool jobSettingsEditable() {
+    return systemState == IDLE || systemState == HOMED_WAITING || systemState == ERROR;
+}
 
+// Values go through the K field table, so C takes the same ranges
+void parseCanvas(const char* input) {
+    static const char* const FIELD_NAMES[] = {"width", "height", "so12", "so34", "offset", "rows12", "rows34"};
+    float v[7];
+    uint8_t n = parseNumbers(input, v, 7);
+    ConfigRecord r = machineConfig;
+    bool valid = n >= 2;
+    for (uint8_t i = 0; valid && i < n; i++) {
+        valid = configFieldSet(r, configFieldFind(FIELD_NAMES[i]), v[i]);
+    }
+    if (!valid) {
+        Serial.println(F("Usage: Cw,h[,so12,so34,offset,rows12,rows34]"));
+        return;
+    }
+    if (!jobSettingsEditable()) {
+        Serial.println(F("Busy"));
+        return;
+    }
+    
+    CanvasParams c = configCanvas(r);
+    c.overtravel = rasterCanvas().overtravel;
+    rasterConfigure(c);
+    printCanvas();
+}
 
-    if (!motorsRunning) {
-        // Find next side to paint
-        while (currentSide < 4 && !sidesToPaint[currentSide]) {
-            currentSide++;
-            currentCommand = 0;
+void parseOvertravel(const char* input) {
+    float v[1];
+    if (parseNumbers(input, v, 1) != 1 || v[0] < 0) {
+        Serial.println(F("Usage: O<inches>"));
+        return;
+    }
+    if (!jobSettingsEditable()) {
+        Serial.println(F("Busy"));
+        return;
+    }
+    
+    CanvasParams c = rasterCanvas();
+    c.overtravel = v[0];
+    rasterConfigure(c);
+    printCanvas();
+}
+
+void parseFlowRate(const char* input) {
+    float v[1];
+    if (parseNumbers(input, v, 1) == 1 && v[0] >= 0) {
+        SPRAY_FLOW_ML_PER_MIN = v[0];
+    } else {
+        Serial.println(F("Usage: F<ml/min>"));
+        return;
+    }
+    Serial.print(F("Spray flow "));
+    Serial.print(SPRAY_FLOW_ML_PER_MIN);
+    Serial.println(F(" ml/min"));
+}
+
+void printProfiles() {
+    for (int side = 0; side < 4; side++) {
+        Serial.print(F("Side "));
+        Serial.print(side + 1);
+        Serial.print(F(": spray "));
+        Serial.print(SIDE_PROFILES[side].sprayPercent);
+        Serial.print(F("%, travel "));
+        Serial.print(SIDE_PROFILES[side].travelPercent);
+        Serial.print(F("%, accel "));
+        Serial.print(SIDE_PROFILES[side].accelPercent);
+        Serial.println(F("%"));
+    }
+}
+
+// A<side>,<spray%>[,travel%[,accel%]]
+void parseProfile(const char* input) {
+    float v[4];
+    uint8_t n = parseNumbers(input, v, 4);
+    if (n < 2 || v[0] < 1 || v[0] > 4) {
+        Serial.println(F("Usage: A<side>,<spray%>[,travel%,accel%]"));
+        return;
+    }
+    if (!jobSettingsEditable()) {
+        Serial.println(F("Busy"));
+        return;
+    }
+    MotionProfile& p = SIDE_PROFILES[(int)v[0] - 1];
+    p.sprayPercent = constrain((int)v[1], 1, 100);
+    if (n >= 3) p.travelPercent = constrain((int)v[2], 1, 100);
+    if (n >= 4) p.accelPercent = constrain((int)v[3], 1, 100);
+    printProfiles();
+}
+
+void printShaping() {
+    static const char* const NAMES[] = {"off", "ZV", "ZVD"};
+    for (uint8_t a = 0; a < 2; a++) {
+        const AxisShaping& s = AXIS_SHAPING[a];
+        Serial.print(a == 0 ? F("X shaper ") : F("Y shaper "));
+        Serial.print(NAMES[s.type]);
+        if (s.type != SHAPER_OFF) {
+            Serial.print(F(" at "));
+            Serial.print(s.frequency, 1);
+            Serial.print(F(" Hz, damping "));
+            Serial.print(s.damping, 2);
+            Serial.print(F(", adds "));
+            Serial.print(shaperDuration(shaperMake((ShaperType)s.type, s.frequency, s.damping)) * 1000.0f, 0);
+            Serial.print(F(" ms per move"));
         }
+        Serial.println();
+    }
+}
+
+// I<X|Y><0|1|2>[,Hz[,damping]]: off, ZV or ZVD on that axis
+void parseShaping(const char* input) {
+    char axis = toupper(input[0]);
+    float v[3];
+    uint8_t n = (axis == 'X' || axis == 'Y') ? parseNumbers(input + 1, v, 3) : 0;
+    if (n < 1 || v[0] < SHAPER_OFF || v[0] > SHAPER_ZVD || (n >= 2 && (v[1] < SHAPER_MIN_HZ || v[1] > SHAPER_MAX_HZ))) {
+        Serial.println(F("Usage: I<X|Y><0 off|1 ZV|2 ZVD>[,Hz,damping]"));
+        return;
+    }
+    if (!jobSettingsEditable()) {
+        Serial.println(F("Busy"));
+        return;
+    }
+    AxisShaping& s = AXIS_SHAPING[axis == 'X' ? 0 : 1];
+    s.type = (uint8_t)v[0];
+    if (n >= 2) s.frequency = v[1];
+    if (n >= 3) s.damping = constrain(v[2], 0.0f, SHAPER_MAX_DAMPING);
+    motionSide = -2;
+    printShaping();
+}
+
+void printCoverage(const char* input) {
+    if (input[0] == '0' && !input[1]) {
+        coverageClear();
+        Serial.println(F("Coverage cleared"));
+        return;
+    }
+    int side = input[0] ? atoi(input) - 1 : -1;
+    if (input[0] && (side < 0 || side >= RASTER_SIDES || input[1])) {
+        Serial.println(F("Usage: M, M<side> or M0"));
+        return;
+    }
+    
+    for (int s = 0; s < RASTER_SIDES; s++) {
+        if (side >= 0 && s != side) continue;
+        Serial.print(F("Side "));
+        Serial.print(s + 1);
+        if (!coverageMapped(s)) {
+            Serial.println(F(": not mapped"));
+            continue;
+        }
+        uint8_t rows = coverageRows(s);
+        float spray = 0;
+        for (uint8_t row = 0; row < rows; row++) spray += coverageRowSeconds(s, row);
+        Serial.print(F(": "));
+        Serial.print(rows);
+        Serial.print(F(" rows, "));
+        Serial.print(rows ? coveragePainted(s) * 100.0f / (rows * COVERAGE_CELLS) : 0.0f, 1);
+        Serial.print(F("% painted, "));
+        Serial.print(coverageGaps(s));
+        Serial.print(F(" missed runs, spray "));
+        Serial.print(spray, 1);
+        Serial.print(F(" s"));
+        if (coverageRowsSkipped(s)) {
+            Serial.print(F(", "));
+            Serial.print(coverageRowsSkipped(s));
+            Serial.print(F(" rows not mapped"));
+        }
+        Serial.println();
+        if (side < 0) continue;
         
-        if (currentSide >= 4) {
-            systemState = CYCLE_COMPLETE;
+        // One character per cell, # painted
+        char cells[COVERAGE_CELLS + 1];
+        cells[COVERAGE_CELLS] = 0;
+        for (uint8_t row = 0; row < rows; row++) {
+            for (uint8_t cell = 0; cell < COVERAGE_CELLS; cell++) {
+                cells[cell] = coverageCell(s, row, cell) ? '#' : '.';
+            }
+            Serial.print(F("Row "));
+            Serial.print(row + 1);
+            Serial.print(F(": "));
+            Serial.print(coverageRowSeconds(s, row), 1);
+            Serial.print(F(" s "));
+            Serial.println(cells);
+        }
+    }
+}
+
+// The running configuration with the canvas as it is now (C, O)
+ConfigRecord currentConfig() {
+    ConfigRecord c = machineConfig;
+    const CanvasParams& canvas = rasterCanvas();
+    float geometry[6] = {canvas.width, canvas.height, canvas.stepOver12, canvas.stepOver34, canvas.offset, canvas.overtravel};
+    memcpy(c.canvas, geometry, sizeof(geometry));
+    c.rows[0] = canvas.rows12;
+    c.rows[1] = canvas.rows34;
+    return c;
+}
+
+void printConfigValue(float value) {
+    Serial.print(value, value == (long)value ? 0 : 2);
+}
+
+// Edits waiting for KW show as old -> new
+void printConfig() {
+    ConfigRecord current = currentConfig();
+    Serial.println(configStaged ? F("Configuration, KW saves the changes, KX drops them:") : F("Configuration:"));
+    for (uint8_t i = 0; i < configFieldCount(); i++) {
+        float value = configFieldValue(current, i);
+        Serial.print(configFieldName(i));
+        Serial.print(F(" = "));
+        printConfigValue(value);
+        if (configStaged && configFieldValue(stagedConfig, i) != value) {
+            Serial.print(F(" -> "));
+            printConfigValue(configFieldValue(stagedConfig, i));
+        }
+        Serial.println();
+    }
+}
+
+// Edits only take effect together with KW, so a move never runs with half
+// of a calibration change
+void saveConfig() {
+    if (systemState != IDLE && systemState != HOMED_WAITING && systemState != ERROR) {
+        Serial.println(F("Busy, save the configuration while idle"));
+        return;
+    }
+    ConfigRecord c = configStaged ? stagedConfig : currentConfig();
+    bool moved = c.stepsPerInch[0] != machineConfig.stepsPerInch[0] || c.stepsPerInch[1] != machineConfig.stepsPerInch[1] ||
+                 ((c.polarity ^ machineConfig.polarity) & (CONFIG_INVERT_X | CONFIG_INVERT_Y));
+    bool saved = configSave(c);
+    applyConfig(c);
+    configStaged = false;
+    Serial.println(saved ? F("Configuration saved and applied") : F("Configuration applied, not saved"));
+    
+    // The homed position no longer means the same steps
+    if (moved && systemState == HOMED_WAITING) {
+        systemState = IDLE;
+        Serial.println(F("Home again (H)"));
+    }
+}
+
+void parseConfig(const char* input) {
+    if ((input[0] == 'W' || input[0] == 'w') && !input[1]) {
+        saveConfig();
+        return;
+    }
+    if ((input[0] == 'X' || input[0] == 'x') && !input[1]) {
+        configStaged = false;
+        Serial.println(F("Configuration changes dropped"));
+        return;
+    }
+    if (input[0] == '0' && !input[1]) {
+        stagedConfig = COMPILED_CONFIG;
+        configStaged = true;
+        printConfig();
+        return;
+    }
+    
+    // name=value[,name=value...], all or nothing
+    ConfigRecord c = configStaged ? stagedConfig : currentConfig();
+    char name[16];
+    const char* p = input;
+    while (*p) {
+        const char* equals = strchr(p, '=');
+        if (!equals || equals == p || equals - p >= (int)sizeof(name)) {
+            Serial.println(F("Usage: K<name>=<value>[,...], KW, KX or K0"));
             return;
         }
-        
-        Command* currentPattern;
-        int patternSize;
-        
-        stepperX.setMaxSpeed(X_SPEED);
-        stepperX.setAcceleration(X_ACCEL);
-        
-        stepperY.setMaxSpeed(Y_SPEED);
-        stepperY.setAcceleration(Y_ACCEL);
+        memcpy(name, p, equals - p);
+        name[equals - p] = 0;
+        int field = configFieldFind(name);
+        char* end;
+        float value = strtod(equals + 1, &end);
+        if (field < 0) {
+            Serial.print(F("Unknown setting "));
+            Serial.println(name);
+            return;
+        }
+        if (end == equals + 1 || (*end && *end != ',') || !configFieldSet(c, field, value)) {
+            Serial.print(F("Bad value for "));
+            Serial.println(name);
+            return;
+        }
+        p = *end ? end + 1 : end;
+    }
+    stagedConfig = c;
+    configStaged = true;
+    printConfig();
+}
+
+void printBatch() {
+    Serial.print(F("Batch: "));
+    Serial.print(batchRemaining());
+    Serial.println(F(" canvases"));
+    for (uint8_t i = 0; i < batchEntries(); i++) {
+        const BatchCanvas& c = batchEntry(i);
+        Serial.print(c.count);
+        Serial.print(F(" x sides "));
+        for (int side = 0; side < 4; side++) {
+            if (c.sides & (1 << side)) Serial.print(side + 1);
+        }
+        Serial.print(F(" at "));
+        Serial.print(c.speedPercent);
+        Serial.println(F("%"));
+    }
+}
+
+// Q<sides>[,speed%[,count]] queues canvases, Q0 empties the queue
+void parseBatch(const char* input) {
+    float v[3];
+    uint8_t n = parseNumbers(input, v, 3);
+    if (n == 1 && v[0] == 0) {
+        if (batchRunning) {
+            Serial.println(F("Busy"));
+            return;
+        }
+        batchClear();
+        printBatch();
+        return;
+    }
+    
+    BatchCanvas c = {0, 100, 1};
+    for (long digits = (long)v[0]; n >= 1 && digits > 0; digits /= 10) {
+        int side = digits % 10;
+        if (side >= 1 && side <= 4) c.sides |= 1 << (side - 1);
+    }
+    if (n >= 2) c.speedPercent = (uint8_t)constrain((int)v[1], 1, 100);
+    if (n >= 3) c.count = (uint8_t)constrain((int)v[2], 1, 255);
+    if (c.sides == 0) {
+        Serial.println(F("Usage: Q<sides>[,speed%,count], Q0 to clear"));
+        return;
+    }
+    if (!batchAdd(c)) {
+        Serial.println(F("Batch queue full"));
+        return;
+    }
+    printBatch();
+}
+
+void parseSprayLead(const char* input) {
+    float v[3];
+    uint8_t n = parseNumbers(input, v, 3);
+    if (n == 3 && v[0] >= 1 && v[0] <= 4) {
+        int side = (int)v[0] - 1;
+        SPRAY_OPEN_LEAD_MS[side] = max((int)v[1], 0);
+        SPRAY_CLOSE_LEAD_MS[side] = max((int)v[2], 0);
+    } else if (n != 0) {
+        Serial.println(F("Usage: V<side>,<openMs>,<closeMs>"));
+        return;
+    }
+    
+    for (int i = 0; i < 4; i++) {
+        Serial.print(F("Side "));
+        Serial.print(i + 1);
+        Serial.print(F(" spray lead open/close ms: "));
+        Serial.print(SPRAY_OPEN_LEAD_MS[i]);
+        Serial.print(F("/"));
+        Serial.println(SPRAY_CLOSE_LEAD_MS[i]);
+    }
+}
 
-        switch(currentSide) {
-            case 0:
-                currentPattern = SIDE1_PATTERN;
-                patternSize = SIDE1_SIZE;
+// Command lines from the network service. A streamed job belongs to the
+// serial host, so while one runs only the stop command gets through. The
+// network settings themselves (W) are only changed over serial.
+bool handleNetworkLine(const char* input, uint8_t length) {
+    bool stopRequest = length == 1 && (input[0] == 'E' || input[0] == 'e');
+    if (systemState == STREAMING_JOB && !stopRequest) return false;
+    if (input[0] == 'W' || input[0] == 'w') return false;
+    handleSerialLine(input, length);
+    return true;
+}
+
+void handleSerialLine(const char* input, uint8_t length) {
+    // While streaming, everything except the stop command is job input
+    bool stopRequest = length == 1 && (input[0] == 'E' || input[0] == 'e');
+    if (systemState == STREAMING_JOB && !stopRequest) {
+        jobStreamLine(input);
+        return;
+    }
+    
+    if (strcasecmp(input, "PRIME") == 0) {
+        startPurge(PURGE_PRIME);
+    } else if (strcasecmp(input, "CLEAN") == 0) {
+        startPurge(PURGE_CLEAN);
+    } else if (strcasecmp(input, "TUNE") == 0) {
+        startTune();
+    } else if (strcasecmp(input, "TOUCHUP") == 0) {
+        startTouchUp();
+    } else if (strcasecmp(input, "TUNE0") == 0) {
+        // The save can erase a flash block and the X/Y limits change
+        if (systemState != IDLE && systemState != HOMED_WAITING) {
+            Serial.println(F("Busy, clear the tuned profile while idle"));
+            return;
+        }
+        SettingsRecord settings;
+        settingsLoad(settings);
+        settings.tunedAxes = 0;
+        applyTuning(settings);
+        Serial.println(settingsSave(settings) ? F("Tuned profile cleared") : F("Settings not saved"));
+    } else if (length == 1) {
+        char cmd = input[0];
+        switch(cmd) {
+            case 'H':
+            case 'h':
+                if (systemState == IDLE) {
+                    homingStart();
+                    systemState = HOMING;
+                }
+                break;
+                
+            case 'S':
+            case 's':
+                if (systemState == HOMED_WAITING) {
+                    JOB_SPEED_PERCENT = 100;
+                    startPattern();
+                } else if (systemState == PRIMING) {
+                    startAfterPurge = true;   // Starts as the prime ends
+                    Serial.println(F("Job starts after the prime"));
+                }
+                break;
+                
+            case 'B':
+            case 'b':
+                if (batchRemaining() == 0) {
+                    Serial.println(F("Batch queue empty"));
+                } else if (systemState == IDLE) {
+                    // The first canvas is on the tray, home and start it
+                    batchRunning = true;
+                    batchLoaded = true;
+                    homingStart();
+                    systemState = HOMING;
+                } else if (systemState == HOMED_WAITING) {
+                    batchRunning = true;
+                    canvasesSinceHome = 0;
+                    startBatchCanvas();
+                }
+                break;
+                
+            case 'N':
+            case 'n':
+                if (systemState == BATCH_WAITING) {
+                    startBatchCanvas();
+                } else if (systemState == HOMING && batchRunning) {
+                    batchLoaded = true;   // Starts once homing is done
+                }
+                break;
+                
+            case 'Q':
+            case 'q':
+                printBatch();
+                break;
+                
+            case 'A':
+            case 'a':
+                printProfiles();
+                break;
+                
+            case 'I':
+            case 'i':
+                printShaping();
+                break;
+                
+            case 'J':
+            case 'j':
+                if (systemState == HOMED_WAITING) {
+                    jobStreamBegin();
+                    applySide(-1);
+                    plannerSetTag(NO_CHECKPOINT_TAG);   // Streamed jobs cannot be resumed
+                    systemState = STREAMING_JOB;
+                }
                 break;
-            case 1:
-                currentPattern = SIDE2_PATTERN;
-                patternSize = SIDE2_SIZE;
+                
+            case 'E':
+            case 'e':
+                stopMachine();
                 break;
-            case 2:
-                currentPattern = SIDE3_PATTERN;
-                patternSize = SIDE3_SIZE;
+                
+            case 'R':
+            case 'r':
+                if (systemState == ERROR && estopTripped() && !estopReset()) {
+                    Serial.println(F("E-stop still open"));
+                } else if (systemState == ERROR) {
+                    systemState = IDLE;
+                }
+                break;
+                
+            case 'V':
+            case 'v':
+                parseSprayLead(input + 1);
+                break;
+                
+            case 'D':
+            case 'd':
+                timingDump(Serial);
                 break;
-            case 3:
-                currentPattern = SIDE4_PATTERN;
-                patternSize = SIDE4_SIZE;
+                
+            case 'T':
+            case 't':
+                printEstimate();
+                break;
+                
+            case 'G':
+            case 'g':
+                if (systemState == IDLE) {
+                    beginResume();
+                } else if (systemState == PAUSED) {
+                    resumePending = true;   // Once the axes have stopped
+                }
+                break;
+                
+            case 'P':
+            case 'p':
+                if (jobRunning()) {
+                    pauseJob();
+                }
+                break;
+                
+            case 'Z':
+            case 'z':
+                printDrift();
+                break;
+                
+            case 'U':
+            case 'u':
+                printTasks();
+                break;
+                
+            case 'M':
+            case 'm':
+                printCoverage(input + 1);
+                break;
+                
+            case 'K':
+            case 'k':
+                printConfig();
                 break;
         }
-        
-        if (currentCommand < patternSize) {
-            executeCommand(currentPattern[currentCommand]);
-            currentCommand++;
-        } else {
-            currentCommand = 0;
-            currentSide++;
+    } else if (input[0] == 'C' || input[0] == 'c') {
+        parseCanvas(input + 1);
+    } else if (input[0] == 'V' || input[0] == 'v') {
+        parseSprayLead(input + 1);
+    } else if (input[0] == 'O' || input[0] == 'o') {
+        parseOvertravel(input + 1);
+    } else if (input[0] == 'F' || input[0] == 'f') {
+        parseFlowRate(input + 1);
+    } else if (input[0] == 'A' || input[0] == 'a') {
+        parseProfile(input + 1);
+    } else if (input[0] == 'I' || input[0] == 'i') {
+        parseShaping(input + 1);
+    } else if (input[0] == 'Q' || input[0] == 'q') {
+        parseBatch(input + 1);
+    } else if (input[0] == 'M' || input[0] == 'm') {
+        printCoverage(input + 1);
+    } else if (input[0] == 'K' || input[0] == 'k') {
+        parseConfig(input + 1);
+    } else if (input[0] == 'L' || input[0] == 'l') {
+        strncpy(jobColor, input + 1, TELEMETRY_COLOR_LENGTH);
+        jobColor[TELEMETRY_COLOR_LENGTH] = 0;
+        Serial.print(F("Color "));
+        Serial.println(jobColor);
+    } else if (input[0] == 'W' || input[0] == 'w') {
+        // W<ssid>,<password>[,<token>], a third field sets the command token
+        char network[33];
+        char key[64];
+        const char* comma = strchr(input + 1, ',');
+        const char* tokenComma = comma ? strchr(comma + 1, ',') : nullptr;
+        int networkLength = comma ? comma - input - 1 : length - 1;
+        int keyLength = comma ? (tokenComma ? tokenComma : input + length) - comma - 1 : 0;
+        if (networkLength > 32 || keyLength > 63 || (tokenComma && strlen(tokenComma + 1) > TELEMETRY_TOKEN_LENGTH)) {
+            Serial.println(F("Usage: W<ssid>,<password>[,<token>], at most 32, 63 and 32 characters"));
+            return;
+        }
+        memcpy(network, input + 1, networkLength);
+        network[networkLength] = 0;
+        memcpy(key, comma ? comma + 1 : "", keyLength);
+        key[keyLength] = 0;
+        if (tokenComma) telemetrySetToken(tokenComma + 1);
+        telemetrySetNetwork(network, key);
+        Serial.print(F("WiFi "));
+        Serial.print(network);
+        Serial.println(telemetryHasToken() ? F(", commands need the token") : F(", no token: network commands refused"));
+    } else if (input[0] == 'Z' || input[0] == 'z') {
+        homeCheckEnabled = input[1] == '1';
+        if (input[1] == '0') homingResetDrift();
+        Serial.print(F("Home switch checks "));
+        Serial.println(homeCheckEnabled ? F("on") : F("off"));
+    } else if ((input[0] == 'U' || input[0] == 'u') && input[1] == '0') {
+        schedulerResetStats();
+        Serial.println(F("Task counters cleared"));
+    } else if ((input[0] == 'D' || input[0] == 'd') && input[1] == '0') {
+        timingReset();
+        Serial.println(F("Timing counters cleared"));
+    } else if (length >= 2) {
+        // Process side selection
+        parseSideSelection(input);
+        Serial.print(F("Selected sides to paint: "));
+        for (int i = 0; i < 4; i++) {
+            if (sidesToPaint[i]) {
+                Serial.print(i + 1);
+                Serial.print(" ");
+            }
         }
+        Serial.println();
     }
 }
 
-void loop() {
-    xHomeSensor.update();
-    yHomeSensor.update();
+// Share of the racetrack pass ramp the step-over may overlap: Y starts once
+// X has braked out past the canvas edge, where the spray window has shut
+float passBlend(const RasterSide& side, const AxisMotion motion[PLAN_AXIS_COUNT]) {
+    float speed = motion[PLAN_AXIS_X].spraySpeed;
+    float accelX = motion[PLAN_AXIS_X].sprayAccel;
+    float over = min(side.overtravelStart, side.overtravelEnd);
+    float ramp = speed * speed / (2.0f * accelX);
+    if (over <= 0 || ramp <= 0) return 0;
+    return constrain(over / ramp, 0.0f, 1.0f);
+}
+
+// Share of the racetrack step-over ramp X may overlap when it turns back:
+// the remaining Y braking time must not exceed the time X needs from rest
+// to cover the overtravel, so the step-over is done at the canvas edge
+float stepOverBlend(const RasterSide& side, const AxisMotion motion[PLAN_AXIS_COUNT]) {
+    // Racetrack passes and step-overs run with the spray on
+    float speed = motion[PLAN_AXIS_Y].spraySpeed;
+    float accelY = motion[PLAN_AXIS_Y].sprayAccel;
+    float over = min(side.overtravelStart, side.overtravelEnd);
+    float ramp = min(speed * speed, accelY * labs(side.stepOverSteps)) / (2.0f * accelY);
+    if (over <= 0 || ramp <= 0) return 0;
+    return constrain(over * accelY / (motion[PLAN_AXIS_X].sprayAccel * ramp), 0.0f, 1.0f);
+}
+
+// Speed, acceleration and corner blend per axis for a side (-1 for streamed
+// jobs), shared by the executor and the estimator
+void sideMotion(int side, AxisMotion motion[PLAN_AXIS_COUNT]) {
+    MotionProfile p = {100, 100, 100};
+    float job = 1.0f;
+    if (side >= 0) {
+        p = SIDE_PROFILES[side];
+        job = JOB_SPEED_PERCENT / 100.0f;
+    }
+    float travel = p.travelPercent / 100.0f * job;
+    float spray = p.sprayPercent / 100.0f * job;
+    float accel = p.accelPercent / 100.0f;
+    Shaper shaper[2];
+    for (uint8_t a = 0; a < 2; a++) {
+        const AxisShaping& s = AXIS_SHAPING[a];
+        shaper[a] = shaperMake((ShaperType)s.type, s.frequency, s.damping);
+    }
+    motion[PLAN_AXIS_X] = {RAPID_X_SPEED * travel, RAPID_X_ACCEL * accel, PLANNER_CORNER_BLEND,
+                           X_SPEED * spray, X_ACCEL * accel, 0, shaper[0]};
+    motion[PLAN_AXIS_Y] = {RAPID_Y_SPEED * travel, RAPID_Y_ACCEL * accel, PLANNER_CORNER_BLEND,
+                           Y_SPEED * spray, Y_ACCEL * accel, 0, shaper[1]};
+    motion[PLAN_AXIS_R] = {(float)ROTATION_SPEED, (float)ROTATION_ACCEL, PLANNER_CORNER_BLEND,
+                           (float)ROTATION_SPEED, (float)ROTATION_ACCEL, (float)ROTATION_JERK,
+                           shaperMake(SHAPER_OFF, 0, 0)};
     
-    motorsRunning = stepperX.isRunning() || 
-                   stepperY.isRunning() || 
-                   stepperRotation.isRunning();
+    // Racetrack rows: the step-over starts as X brakes in the overtravel
+    if (side >= 0 && rasterSide(side).overtravelEnd > 0) {
+        motion[PLAN_AXIS_X].blend = passBlend(rasterSide(side), motion);
+        motion[PLAN_AXIS_Y].blend = stepOverBlend(rasterSide(side), motion);
+    }
+}
+
+void applyMotion(const AxisMotion motion[PLAN_AXIS_COUNT]) {
+    for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) {
+        plannerSetLimits(a, motion[a].speed, motion[a].accel);
+        plannerSetSprayLimits(a, motion[a].spraySpeed, motion[a].sprayAccel);
+        plannerSetCornerBlend(a, motion[a].blend);
+        plannerSetJerk(a, motion[a].jerk);
+        plannerSetShaper(a, motion[a].shaper);
+    }
+}
+
+// Profile and valve leads for the moves queued next (-1 for streamed jobs)
+void applySide(int side) {
+    AxisMotion motion[PLAN_AXIS_COUNT];
+    sideMotion(side, motion);
+    applyMotion(motion);
+    int lead = side >= 0 ? side : 0;
+    plannerSetSprayLead(SPRAY_OPEN_LEAD_MS[lead], SPRAY_CLOSE_LEAD_MS[lead]);
+    motionSide = side;
+}
+
+// Order, start corners and rotations for the selected sides, from the
+// quarter turn the tray stands at
+void planJob(uint8_t startQuarter) {
+    AxisMotion motion[RASTER_SIDES][PLAN_AXIS_COUNT];
+    for (int side = 0; side < RASTER_SIDES; side++) {
+        sideMotion(side, motion[side]);
+    }
+    jobStartQuarter = startQuarter;
+    sideOrderPlan(sidesToPaint, motion, startQuarter);
+}
+
+void startPattern() {
+    jobActive = true;
+    jobStartedAt = millis();
+    planJob(rotaryNearestQuarter(stepperRotation.currentPosition()));
+    planCheckpoints();
+    for (int side = 0; side < RASTER_SIDES; side++) {
+        if (sidesToPaint[side]) {
+            coverageStart(side, rasterSide(side), SPRAY_OPEN_LEAD_MS[side], SPRAY_CLOSE_LEAD_MS[side]);
+        }
+    }
+    currentStep = 0;
+    currentCommand = 0;
+    motionSide = -2;
+    homeCheckDue = false;
+    resumeTag = NO_CHECKPOINT_TAG;
+    lastCheckpointAt = millis();
+    // The plan turns between absolute side angles, like touch-up does; a tray
+    // left between quarters (streamed jobs) is squared up to its quarter first
+    long square = rotaryShortest(stepperRotation.currentPosition(), rotaryQuarter(jobStartQuarter));
+    if (square != 0 && sideOrderCount() > 0) {
+        applySide(sideOrderSide(0));
+        plannerSetTag(NO_CHECKPOINT_TAG);
+        plannerMove(PLAN_AXIS_R, square, false);
+    }
+    systemState = EXECUTING_PATTERN;
+}
+
+void startBatchCanvas() {
+    BatchCanvas c;
+    if (!batchNext(c)) {
+        batchRunning = false;
+        systemState = IDLE;
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        sidesToPaint[i] = c.sides & (1 << i);
+    }
+    JOB_SPEED_PERCENT = c.speedPercent;
+    batchLoaded = false;
+    Serial.print(F("Batch canvas, "));
+    Serial.print(batchRemaining());
+    Serial.println(F(" left after it"));
+    startPattern();
+}
+
+void printEstimate() {
+    planJob(rotaryNearestQuarter(stepperRotation.currentPosition()));
+    estimatorBegin();
+    float total = 0;
+    float spray = 0;
+    for (int step = 0; step < sideOrderCount(); step++) {
+        int side = sideOrderSide(step);
+        AxisMotion motion[PLAN_AXIS_COUNT];
+        sideMotion(side, motion);
+        SideEstimate e = estimatorSide(side, motion);
+        total += e.seconds;
+        spray += e.spraySeconds;
+        Serial.print(F("Side "));
+        Serial.print(side + 1);
+        Serial.print(F(": "));
+        Serial.print(e.seconds, 1);
+        Serial.print(F(" s, spray "));
+        Serial.print(e.spraySeconds, 1);
+        Serial.println(F(" s"));
+    }
+    Serial.print(F("Total: "));
+    Serial.print(total, 1);
+    Serial.println(F(" s"));
+    if (SPRAY_FLOW_ML_PER_MIN > 0) {
+        Serial.print(F("Paint: "));
+        Serial.print(spray * SPRAY_FLOW_ML_PER_MIN / 60.0f, 1);
+        Serial.println(F(" ml"));
+    }
+}
+
+// Whole job length for the side order planJob() made
+float estimateJob() {
+    estimatorBegin();
+    float total = 0;
+    for (int step = 0; step < sideOrderCount(); step++) {
+        AxisMotion motion[PLAN_AXIS_COUNT];
+        sideMotion(sideOrderSide(step), motion);
+        total += estimatorSide(sideOrderSide(step), motion).seconds;
+    }
+    return total;
+}
+
+// Spread the records over the free log so a long job never runs into a used
+// block; erases only happen while the machine stands
+void planCheckpoints() {
+    uint16_t slots = checkpointFreeSlots();
+    slots = slots > CHECKPOINT_RESERVED_SLOTS ? slots - CHECKPOINT_RESERVED_SLOTS : 1;
+    unsigned long spread = (unsigned long)(estimateJob() * 1000.0f / slots);
+    checkpointInterval = max(CHECKPOINT_INTERVAL_MS, spread);
+}
+
+// Everything the side plan depends on besides the selection and job speed
+uint32_t canvasHash() {
+    // FNV-1a over the fields, the struct has padding
+    const CanvasParams& c = rasterCanvas();
+    float fields[6] = {c.width, c.height, c.stepOver12, c.stepOver34, c.offset, c.overtravel};
+    uint32_t h = 2166136261u;
+    const uint8_t* bytes = (const uint8_t*)fields;
+    for (size_t i = 0; i < sizeof(fields); i++) h = (h ^ bytes[i]) * 16777619u;
+    h = (h ^ c.rows12) * 16777619u;
+    h = (h ^ c.rows34) * 16777619u;
+    h = (h ^ X_STEPS_PER_INCH) * 16777619u;
+    h = (h ^ Y_STEPS_PER_INCH) * 16777619u;
+    for (int side = 0; side < 4; side++) {
+        h = (h ^ SIDE_PROFILES[side].sprayPercent) * 16777619u;
+        h = (h ^ SIDE_PROFILES[side].travelPercent) * 16777619u;
+        h = (h ^ SIDE_PROFILES[side].accelPercent) * 16777619u;
+    }
+    return h;
+}
+
+// The last side keeps running after everything is queued
+bool jobRunning() {
+    return systemState == EXECUTING_PATTERN || (systemState == CYCLE_COMPLETE && motorsRunning);
+}
+
+// Side a planner tag paints, -1 for moves off the canvas sides
+int tagSide(uint32_t tag) {
+    if (tag == NO_CHECKPOINT_TAG) return -1;
+    int side = (tag & 0xFFFF0000) == TOUCHUP_TAG ? tag & 0xFFFF : tag >> 16;
+    return side < RASTER_SIDES ? side : -1;
+}
+
+// Where the running pattern job stands, false if nothing of it is queued
+bool captureCheckpoint(CheckpointRecord& r) {
+    memset(&r, 0, sizeof(r));
+    PlanProgress p;
+    if (!plannerProgress(p) || p.tag == NO_CHECKPOINT_TAG || (p.tag & 0xFFFF0000) == TOUCHUP_TAG) return false;
+    r.status = CHECKPOINT_STATUS_ACTIVE;
+    r.side = p.tag >> 16;
+    r.command = p.tag & 0xFFFF;
+    r.stepsDone = p.stepsDone + (p.tag == resumeTag ? resumeOffset : 0);
+    for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) r.position[a] = p.resume[a];
+    r.canvasHash = canvasHash();
+    for (int i = 0; i < 4; i++) {
+        if (sidesToPaint[i]) r.sides |= 1 << i;
+    }
+    r.sides |= jobStartQuarter << 4;
+    r.speedPercent = JOB_SPEED_PERCENT;
+    return true;
+}
+
+void fillTelemetry(TelemetryStatus& status) {
+    status.state = STATE_NAMES[systemState];
+    PlanProgress p;
+    if (jobRunning() && plannerProgress(p) && tagSide(p.tag) >= 0) {
+        status.side = tagSide(p.tag) + 1;
+        status.command = (p.tag & 0xFFFF0000) == TOUCHUP_TAG ? 0 : p.tag & 0xFFFF;
+    } else if (jobRunning() || systemState == PAUSED) {
+        status.side = currentSide + 1;
+        status.command = currentCommand;
+    }
+    status.position[0] = stepperX.currentPosition();
+    status.position[1] = stepperY.currentPosition();
+    status.position[2] = stepperRotation.currentPosition();
+    status.spray = stepEngineSprayOn();
+    status.batchRemaining = batchRemaining();
+    status.color = jobColor;
+}
+
+// Status frame payload (little-endian):
+//   uint8 state (SystemState), uint8 side, uint16 command,
+//   int32 x, y, r steps, uint8 spray, uint8 batch remaining (255 = 255 or more),
+//   uint8 streamed moves buffered, uint32 millis()
+void sendStatusFrame() {
+    TelemetryStatus s = {"", 0, 0, {0, 0, 0}, false, 0, ""};
+    fillTelemetry(s);
+    uint8_t payload[23];
+    payload[0] = systemState;
+    payload[1] = s.side;
+    framePutUint16(payload + 2, s.command);
+    for (uint8_t i = 0; i < 3; i++) framePutInt32(payload + 4 + 4 * i, s.position[i]);
+    payload[16] = s.spray;
+    payload[17] = min(s.batchRemaining, (uint16_t)255);
+    payload[18] = jobStreamBuffered();
+    framePutInt32(payload + 19, millis());
+    frameSend(Serial, FRAME_STATUS, payload, sizeof(payload));
+    lastStatusFrame = millis();
+}
+
+void handleFrame(const Frame& frame) {
+    switch (frame.opcode) {
+        case FRAME_LINE:
+            if (frame.length > 0) handleSerialLine((const char*)frame.payload, frame.length);
+            break;
+
+        case FRAME_STATUS:
+            statusFramePeriod = frameUint16(frame, 0);
+            sendStatusFrame();
+            break;
+
+        default:
+            if (systemState == STREAMING_JOB) {
+                jobStreamFrame(frame);
+            } else {
+                frameSendText(Serial, FRAME_REJECT, "not streaming");
+            }
+            break;
+    }
+}
+
+void logJob(bool completed) {
+    TelemetryJob j;
+    j.finishedAt = millis();
+    j.seconds = (j.finishedAt - jobStartedAt) / 1000.0f;
+    j.sides = 0;
+    for (int i = 0; i < 4; i++) {
+        if (sidesToPaint[i]) j.sides |= 1 << i;
+    }
+    j.speedPercent = JOB_SPEED_PERCENT;
+    j.completed = completed;
+    strcpy(j.color, jobColor);
+    telemetryLogJob(j);
+    jobActive = false;
+}
+
+void queueCheckpoint(uint8_t status) {
+    CheckpointRecord r;
+    if (status == CHECKPOINT_STATUS_ACTIVE) {
+        if (!captureCheckpoint(r)) return;
+    } else {
+        memset(&r, 0, sizeof(r));
+        r.status = status;
+    }
+    checkpointQueued = r;
+    checkpointQueuedValid = true;
+}
+
+void serviceCheckpoint() {
+    if (jobRunning() && millis() - lastCheckpointAt >= checkpointInterval) {
+        lastCheckpointAt = millis();
+        queueCheckpoint(CHECKPOINT_STATUS_ACTIVE);
+    }
+    if (checkpointQueuedValid && checkpointWrite(checkpointQueued)) {
+        checkpointQueuedValid = false;
+    }
+    checkpointService(!motorsRunning);
+    
+    // Once per stall, it clears with the erases after the machine stops
+    if (checkpointStalled() != checkpointStallReported) {
+        checkpointStallReported = checkpointStalled();
+        if (checkpointStallReported) Serial.println(F("Checkpoints stopped: log full until the machine stands still"));
+    }
+}
+
+// Brake every axis along its profile with the spray closed at the point
+// the job is resumed from, then drop the rest of the queue
+void pauseJob() {
+    if (!captureCheckpoint(resumeRecord)) return;
+    stepEngineSetSpray(false);
+    stepEngineClearSprayWindow();
+    stepperX.stop();
+    stepperY.stop();
+    stepperRotation.stop();
+    stepEngineStopLine();
+    plannerClear();
+    
+    // Also kept in flash, so E or a power loss while paused can still resume
+    checkpointQueued = resumeRecord;
+    checkpointQueuedValid = true;
+    resumePending = false;
+    systemState = PAUSED;
+    Serial.print(F("Paused on side "));
+    Serial.print(resumeRecord.side + 1);
+    Serial.println(F(", G to resume"));
+}
+
+void beginResume() {
+    if (!checkpointLoad(resumeRecord) || resumeRecord.status != CHECKPOINT_STATUS_ACTIVE) {
+        Serial.println(F("No job to resume"));
+        return;
+    }
+    if (resumeRecord.canvasHash != canvasHash() || resumeRecord.side >= 4) {
+        Serial.println(F("Canvas or profiles changed since the checkpoint, cannot resume"));
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        sidesToPaint[i] = resumeRecord.sides & (1 << i);
+    }
+    JOB_SPEED_PERCENT = resumeRecord.speedPercent ? resumeRecord.speedPercent : 100;
+    batchRunning = false;
+    // Same selection, speed, canvas and start quarter give the same plan the job ran with
+    planJob((resumeRecord.sides >> 4) & 3);
+    if (sideOrderStep(resumeRecord.side) < 0 || resumeRecord.command >= rasterLength(resumeRecord.side)) {
+        Serial.println(F("Canvas or profiles changed since the checkpoint, cannot resume"));
+        return;
+    }
+    // The tray has no home switch, trust it has not been turned
+    stepperRotation.setCurrentPosition(resumeRecord.position[PLAN_AXIS_R]);
+    resumePending = true;
+    homingStart();
+    systemState = HOMING;
+}
+
+long stepSign(long steps) {
+    return steps < 0 ? -1 : 1;
+}
+
+// After re-homing: go back to the checkpoint position with the spray and
+// spray window as they were there, then finish the interrupted command
+void startResume() {
+    int side = resumeRecord.side;
+    int command = resumeRecord.command;
+    planCheckpoints();
+    
+    bool spraying = false;
+    int windowAt = -1;
+    for (int i = 0; i < command; i++) {
+        PatternOp op = rasterOp(side, i);
+        if (op.type() == 'S') spraying = op.sprayOn();
+        if (op.type() == 'W') windowAt = op.sprayOn() && op.steps() != 0 ? i : -1;
+    }
+    
+    PatternOp op = rasterOp(side, command);
+    bool isMove = op.type() == 'X' || op.type() == 'Y' || op.type() == 'R';
+    long done = isMove ? constrain((long)resumeRecord.stepsDone, 0L, labs(op.steps())) : 0;
+    
+    applySide(side);
+    plannerSetTag(NO_CHECKPOINT_TAG);
+    
+    long x = stepperX.currentPosition();
+    long y = stepperY.currentPosition();
+    if (windowAt >= 0) {
+        // The window starts where X stood when it was reached
+        long windowX = resumeRecord.position[PLAN_AXIS_X] - (op.type() == 'X' ? stepSign(op.steps()) * done : 0);
+        for (int i = windowAt + 1; i < command; i++) {
+            PatternOp prior = rasterOp(side, i);
+            if (prior.type() == 'X') windowX -= prior.steps();
+        }
+        plannerMove(PLAN_AXIS_X, windowX - x, false);
+        x = windowX;
+        executeCommand(rasterOp(side, windowAt).toCommand());
+    }
+    plannerMove(PLAN_AXIS_X, resumeRecord.position[PLAN_AXIS_X] - x, false);
+    plannerMove(PLAN_AXIS_Y, resumeRecord.position[PLAN_AXIS_Y] - y, false);
+    plannerMove(PLAN_AXIS_R, resumeRecord.position[PLAN_AXIS_R] - stepperRotation.currentPosition(), false);
+    if (spraying) plannerSpray(true);
+    
+    resumeTag = ((uint32_t)side << 16) | command;
+    resumeOffset = done;
+    plannerSetTag(resumeTag);
+    if (isMove) {
+        executeCommand(Command(op.type(), op.steps() - stepSign(op.steps()) * done, op.sprayOn()));
+    } else {
+        executeCommand(op.toCommand());
+    }
+    
+    currentStep = sideOrderStep(side);
+    currentSide = side;
+    currentCommand = command + 1;
+    lastCheckpointAt = millis();
+    if (!jobActive) {
+        // Resumed after E or a power loss: logged as a job of its own
+        jobActive = true;
+        jobStartedAt = millis();
+    }
+    systemState = EXECUTING_PATTERN;
+    Serial.print(F("Resuming side "));
+    Serial.print(side + 1);
+    Serial.print(F(" at command "));
+    Serial.println(command);
+}
+
+// After a batch canvas: finish the batch, or wait for the swap, re-homing
+// meanwhile when it is due
+void nextBatchCanvas() {
+    canvasesSinceHome++;
+    if (batchRemaining() == 0) {
+        batchRunning = false;
+        Serial.println(F("Batch complete"));
+        return;
+    }
+    Serial.println(F("Load the next canvas, N when ready"));
+    if (canvasesSinceHome >= BATCH_HOME_EVERY) {
+        batchLoaded = false;
+        homingStart();
+        systemState = HOMING;
+    } else {
+        systemState = BATCH_WAITING;
+    }
+}
+
+void printDrift() {
+    const char* names[2] = {"X", "Y"};
+    for (uint8_t axis = 0; axis < 2; axis++) {
+        const HomingDrift& d = homingDrift(axis);
+        Serial.print(names[axis]);
+        Serial.print(F(": "));
+        Serial.print(d.checks);
+        Serial.print(F(" checks"));
+        if (d.checks > 0) {
+            Serial.print(F(", last "));
+            Serial.print(d.last);
+            Serial.print(F(", mean "));
+            Serial.print((float)d.total / d.checks, 1);
+            Serial.print(F(", worst "));
+            Serial.print(d.worst);
+            Serial.print(F(" steps, recent"));
+            for (uint8_t i = 0; i < min((uint16_t)HOMING_DRIFT_HISTORY, d.checks); i++) {
+                Serial.print(' ');
+                Serial.print(d.history[i]);
+            }
+        }
+        Serial.println();
+    }
+}
+
+// E and the E-stop input: the machine stops and waits for R
+void stopMachine() {
+    // Remember where the job stood before the queue is dropped
+    if (jobRunning()) queueCheckpoint(CHECKPOINT_STATUS_ACTIVE);
+    if (jobActive) logJob(false);
+    resumePending = false;
+    homeCheckDue = false;
+    purgeHoming = false;
+    startAfterPurge = false;
+    batchRunning = false;     // The rest of the queue stays for the next B
+    systemState = ERROR;
+    stepperX.stop();
+    stepperY.stop();
+    stepperRotation.stop();
+    stepEngineStopLine();
+    plannerClear();
+    jobStreamAbort();
+    homingAbort();
+    purgeAbort();
+    autotuneAbort();
+    stepEngineSetSpray(false);
+}
+
+// The values in the globals above
+void compiledConfig(ConfigRecord& c) {
+    memset(&c, 0, sizeof(c));
+    c.version = CONFIG_VERSION;
+    c.polarity = COMPILED_POLARITY;
+    c.stepsPerInch[0] = X_STEPS_PER_INCH;
+    c.stepsPerInch[1] = Y_STEPS_PER_INCH;
+    c.speed[0] = X_SPEED;
+    c.speed[1] = Y_SPEED;
+    c.speed[2] = ROTATION_SPEED;
+    c.accel[0] = X_ACCEL;
+    c.accel[1] = Y_ACCEL;
+    c.accel[2] = ROTATION_ACCEL;
+    c.rapidSpeed[0] = RAPID_X_SPEED;
+    c.rapidSpeed[1] = RAPID_Y_SPEED;
+    c.rapidAccel[0] = RAPID_X_ACCEL;
+    c.rapidAccel[1] = RAPID_Y_ACCEL;
+    c.rotationJerk = ROTATION_JERK;
+    const CanvasParams& canvas = DEFAULT_CANVAS;
+    float geometry[6] = {canvas.width, canvas.height, canvas.stepOver12, canvas.stepOver34, canvas.offset, canvas.overtravel};
+    memcpy(c.canvas, geometry, sizeof(geometry));
+    c.rows[0] = canvas.rows12;
+    c.rows[1] = canvas.rows34;
+}
+
+CanvasParams configCanvas(const ConfigRecord& c) {
+    CanvasParams canvas = DEFAULT_CANVAS;
+    canvas.width = c.canvas[0];
+    canvas.height = c.canvas[1];
+    canvas.stepOver12 = c.canvas[2];
+    canvas.stepOver34 = c.canvas[3];
+    canvas.offset = c.canvas[4];
+    canvas.overtravel = c.canvas[5];
+    canvas.rows12 = c.rows[0];
+    canvas.rows34 = c.rows[1];
+    return canvas;
+}
+
+// Configured limits first, the TUNE profile goes over them
+void applyConfig(const ConfigRecord& c) {
+    if (c.stepsPerInch[0] != X_STEPS_PER_INCH || c.stepsPerInch[1] != Y_STEPS_PER_INCH) {
+        homingSetStepsPerInch(c.stepsPerInch[0], c.stepsPerInch[1]);
+    }
+    X_STEPS_PER_INCH = c.stepsPerInch[0];
+    Y_STEPS_PER_INCH = c.stepsPerInch[1];
+    ROTATION_SPEED = c.speed[2];
+    ROTATION_ACCEL = c.accel[2];
+    ROTATION_JERK = c.rotationJerk;
+    AXIS_DEFAULTS[0] = {(int)c.speed[0], (int)c.accel[0], (int)c.rapidSpeed[0], (int)c.rapidAccel[0]};
+    AXIS_DEFAULTS[1] = {(int)c.speed[1], (int)c.accel[1], (int)c.rapidSpeed[1], (int)c.rapidAccel[1]};
+    
+    stepperX.setPinsInverted(c.polarity & CONFIG_INVERT_X);
+    stepperY.setPinsInverted(c.polarity & CONFIG_INVERT_Y);
+    stepperRotation.setPinsInverted(c.polarity & CONFIG_INVERT_R);
+    stepperRotation.setMaxSpeed(ROTATION_SPEED);
+    stepperRotation.setAcceleration(ROTATION_ACCEL);
+    stepEngineAttachSpray(PAINT_RELAY_PIN, c.polarity & CONFIG_RELAY_ACTIVE_LOW);
+    
+    rasterConfigure(configCanvas(c));
+    SettingsRecord settings;
+    settingsLoad(settings);
+    applyTuning(settings);
+    machineConfig = c;
+}
+
+// Tuned axes take the saved profile, the others the configured limits. The
+// spray speed is a painting choice and is only capped by the tuned speed.
+void applyTuning(const SettingsRecord& settings) {
+    int* sprayAccel[2] = {&X_ACCEL, &Y_ACCEL};
+    int* spraySpeed[2] = {&X_SPEED, &Y_SPEED};
+    int* rapidSpeed[2] = {&RAPID_X_SPEED, &RAPID_Y_SPEED};
+    int* rapidAccel[2] = {&RAPID_X_ACCEL, &RAPID_Y_ACCEL};
+    for (uint8_t a = 0; a < 2; a++) {
+        if (settings.tunedAxes & (1 << a)) {
+            *rapidSpeed[a] = settings.rapidSpeed[a];
+            *rapidAccel[a] = settings.accel[a];
+            *sprayAccel[a] = settings.accel[a];
+            *spraySpeed[a] = min(AXIS_DEFAULTS[a].spraySpeed, *rapidSpeed[a]);
+        } else {
+            *spraySpeed[a] = AXIS_DEFAULTS[a].spraySpeed;
+            *rapidSpeed[a] = AXIS_DEFAULTS[a].rapidSpeed;
+            *rapidAccel[a] = AXIS_DEFAULTS[a].rapidAccel;
+            *sprayAccel[a] = AXIS_DEFAULTS[a].sprayAccel;
+        }
+    }
+    stepperX.setAcceleration(X_ACCEL);
+    stepperY.setAcceleration(Y_ACCEL);
+    motionSide = -2;
+}
+
+// Ladders start from the current limits, see autotune.h
+void startTune() {
+    if (systemState != HOMED_WAITING || !homingCalibrated()) {
+        Serial.println(F("TUNE needs a fresh homing (H)"));
+        return;
+    }
+    float speed[2] = {(float)RAPID_X_SPEED, (float)RAPID_Y_SPEED};
+    float accel[2] = {(float)min(X_ACCEL, RAPID_X_ACCEL), (float)min(Y_ACCEL, RAPID_Y_ACCEL)};
+    plannerClear();
+    autotuneStart(speed, accel);
+    systemState = TUNING;
+}
+
+void finishTune() {
+    SettingsRecord settings;
+    settingsLoad(settings);
+    settings.tunedAxes = 0x3;
+    for (uint8_t a = 0; a < 2; a++) {
+        const TuneResult& r = autotuneResult(a);
+        settings.rapidSpeed[a] = r.speed;
+        settings.accel[a] = r.accel;
+        Serial.print(a == 0 ? F("Tuned X ") : F("Tuned Y "));
+        Serial.print(r.speed, 0);
+        Serial.print(F(" steps/s, "));
+        Serial.print(r.accel, 0);
+        Serial.print(F(" steps/s^2"));
+        if (!r.limited) Serial.print(F(" (top of the ladder)"));
+        Serial.println();
+    }
+    applyTuning(settings);
+    Serial.println(settingsSave(settings) ? F("Saved") : F("Settings not saved"));
+    // The checks moved the head, the planner picks the axes up from here
+    plannerClear();
+    systemState = HOMED_WAITING;
+}
+
+// From IDLE the cycle homes, from HOMED_WAITING it goes to the home corner
+void startPurge(PurgeCycle cycle) {
+    if (systemState == IDLE) {
+        homingStart();
+        purgeHoming = true;
+    } else if (systemState == HOMED_WAITING) {
+        applySide(-1);
+        plannerSetTag(NO_CHECKPOINT_TAG);
+        plannerMove(PLAN_AXIS_X, -stepperX.currentPosition(), false);
+        plannerMove(PLAN_AXIS_Y, -stepperY.currentPosition(), false);
+        purgeHoming = false;
+    } else {
+        return;
+    }
+    startAfterPurge = false;
+    purgeStart(cycle);
+    systemState = cycle == PURGE_PRIME ? PRIMING : CLEANING;
+}
+
+void processPurge() {
+    bool inZone;
+    if (purgeHoming) {
+        homingUpdate();
+        if (homingFailed()) {
+            homingAbort();
+            purgeAbort();
+            purgeHoming = false;
+            stepperX.stop();
+            stepperY.stop();
+            systemState = ERROR;
+            Serial.println(F("Homing failed"));
+            return;
+        }
+        inZone = homingAtSwitches();
+        if (homingDone()) {
+            homingAbort();
+            purgeHoming = false;
+            Serial.println(F("Homing complete"));
+        }
+    } else {
+        inZone = purgeInZone(stepperX.currentPosition(), stepperY.currentPosition());
+    }
+    purgeUpdate(inZone);
     
-    stepperX.run();
-    stepperY.run();
-    stepperRotation.run();
+    if (!purgeDone() || purgeHoming || motorsRunning) return;
+    purgeAbort();
+    Serial.println(purgeCycle() == PURGE_PRIME ? F("Prime done") : F("Clean done"));
+    if (startAfterPurge) {
+        startAfterPurge = false;
+        JOB_SPEED_PERCENT = 100;
+        startPattern();
+    } else {
+        systemState = HOMED_WAITING;
+        Serial.println(F("Enter 'S' to start painting."));
+    }
+}
+
+// Between sides: run to the switches at rapid speed, then back to the
+// side exit point with the corrected positions
+void startHomeCheck() {
+    homeCheckDue = false;
+    homeCheckReturn[0] = stepperX.currentPosition();
+    homeCheckReturn[1] = stepperY.currentPosition();
+    homeCheckSpeed[0] = stepperX.maxSpeed();
+    homeCheckSpeed[1] = stepperY.maxSpeed();
+    stepperX.setMaxSpeed(RAPID_X_SPEED);
+    stepperY.setMaxSpeed(RAPID_Y_SPEED);
+    homingCheckStart();
+    systemState = CHECKING_HOME;
+}
+
+void finishHomeCheck() {
+    homingAbort();
+    stepperX.setMaxSpeed(homeCheckSpeed[0]);
+    stepperY.setMaxSpeed(homeCheckSpeed[1]);
+    // The planner picks the moved axes up from their new positions
+    plannerClear();
+    plannerSetTag(NO_CHECKPOINT_TAG);
+    plannerMove(PLAN_AXIS_X, homeCheckReturn[0] - stepperX.currentPosition(), false);
+    plannerMove(PLAN_AXIS_Y, homeCheckReturn[1] - stepperY.currentPosition(), false);
+    Serial.print(F("Home check drift X "));
+    Serial.print(homingDrift(0).last);
+    Serial.print(F(", Y "));
+    Serial.print(homingDrift(1).last);
+    Serial.println(F(" steps"));
+    systemState = EXECUTING_PATTERN;
+}
+
+void processPattern() {
+    if (homeCheckDue) {
+        if (!motorsRunning) startHomeCheck();
+        return;
+    }
     
-    if (Serial.available()) {
-        String input = Serial.readStringUntil('\n');
-        input.trim();
+    // Keep the planner's look-ahead window full
+    while (!plannerFull()) {
+        if (currentStep >= sideOrderCount()) {
+            if (batchRunning && batchRemaining() > 0) {
+                // Present side 1 for the next canvas while the head goes home
+                plannerSetTag(NO_CHECKPOINT_TAG);
+                plannerMove(PLAN_AXIS_R, sideOrderLoadTurn(), false);
+            }
+            systemState = CYCLE_COMPLETE;
+            return;
+        }
+        currentSide = sideOrderSide(currentStep);
+        if (currentSide != motionSide) applySide(currentSide);
         
-        if (input.length() == 1) {
-            char cmd = input.charAt(0);
-            switch(cmd) {
-                case 'H':
-                case 'h':
-                    if (systemState == IDLE) {
-                        systemState = HOMING_X;
-                    }
-                    break;
-                    
-                case 'S':
-                case 's':
-                    if (systemState == HOMED_WAITING) {
-                        currentSide = 0;
-                        currentCommand = 0;
-                        systemState = EXECUTING_PATTERN;
-                    }
-                    break;
-                    
-                case 'E':
-                case 'e':
-                    systemState = ERROR;
-                    digitalWrite(PAINT_RELAY_PIN, HIGH);
-                    stepperX.stop();
-                    stepperY.stop();
-                    stepperRotation.stop();
-                    break;
-                    
-                case 'R':
-                case 'r':
-                    if (systemState == ERROR) {
-                        systemState = IDLE;
-                    }
-                    break;
+        if (currentCommand < rasterLength(currentSide)) {
+            plannerSetTag(((uint32_t)currentSide << 16) | currentCommand);
+            executeCommand(rasterOp(currentSide, currentCommand).toCommand());
+            currentCommand++;
+        } else {
+            currentCommand = 0;
+            currentStep++;
+            if (homeCheckEnabled && currentStep < sideOrderCount()) {
+                homeCheckDue = true;
+                return;
             }
-        } else if (input.length() >= 2) {
-            // Process side selection
-            parseSideSelection(input);
-            Serial.print(F("Selected sides to paint: "));
-            for (int i = 0; i < 4; i++) {
-                if (sidesToPaint[i]) {
-                    Serial.print(i + 1);
-                    Serial.print(" ");
-                }
+        }
+    }
+}
+
+// A job stopped part way, after homing: paint the missed runs of every
+// mapped side and nothing else
+void startTouchUp() {
+    if (systemState != HOMED_WAITING) {
+        Serial.println(F("TOUCHUP needs homing (H) first"));
+        return;
+    }
+    uint16_t gaps = 0;
+    for (uint8_t side = 0; side < RASTER_SIDES; side++) gaps += coverageGaps(side);
+    if (!gaps) {
+        Serial.println(F("Nothing to touch up"));
+        return;
+    }
+    touchSide = 0;
+    touchRow = 0;
+    touchCell = 0;
+    touchMoveCount = 0;
+    touchMoveNext = 0;
+    touchAt[PLAN_AXIS_X] = stepperX.currentPosition();
+    touchAt[PLAN_AXIS_Y] = stepperY.currentPosition();
+    touchAt[PLAN_AXIS_R] = stepperRotation.currentPosition();
+    motionSide = -2;
+    Serial.print(F("Touching up "));
+    Serial.print(gaps);
+    Serial.println(F(" missed runs"));
+    systemState = TOUCHING_UP;
+}
+
+void queueTouchMove(char axis, long to) {
+    uint8_t a = axis == 'X' ? PLAN_AXIS_X : axis == 'Y' ? PLAN_AXIS_Y : PLAN_AXIS_R;
+    if (to == touchAt[a]) return;
+    touchMoves[touchMoveCount++] = Command(axis, to - touchAt[a], false);
+    touchAt[a] = to;
+}
+
+// Present the side, go dry to the nearer end of the run and paint across it
+void queueTouchGap(const CoverageGap& gap) {
+    touchMoveCount = 0;
+    touchMoveNext = 0;
+    long trayAngle = touchAt[PLAN_AXIS_R] + rotaryShortest(touchAt[PLAN_AXIS_R], rasterSide(touchSide).trayAngle);
+    queueTouchMove('R', trayAngle);
+    bool reverse = labs(touchAt[PLAN_AXIS_X] - gap.toX) < labs(touchAt[PLAN_AXIS_X] - gap.fromX);
+    queueTouchMove('X', reverse ? gap.toX : gap.fromX);
+    queueTouchMove('Y', gap.y);
+    touchMoves[touchMoveCount++] = Command('S', 0, true);
+    long end = reverse ? gap.fromX : gap.toX;
+    touchMoves[touchMoveCount++] = Command('X', end - touchAt[PLAN_AXIS_X], true);
+    touchAt[PLAN_AXIS_X] = end;
+    touchMoves[touchMoveCount++] = Command('S', 0, false);
+}
+
+void processTouchUp() {
+    while (!plannerFull()) {
+        if (touchMoveNext < touchMoveCount) {
+            executeCommand(touchMoves[touchMoveNext++]);
+            continue;
+        }
+        if (touchSide >= RASTER_SIDES) {
+            systemState = CYCLE_COMPLETE;
+            return;
+        }
+        CoverageGap gap;
+        if (!coverageNextGap(touchSide, touchRow, touchCell, gap)) {
+            if (++touchSide < RASTER_SIDES) {
+                touchRow = 0;
+                touchCell = 0;
+                continue;
             }
-            Serial.println();
+            // Back to the home corner and side 1, where a job starts from
+            touchMoveCount = 0;
+            touchMoveNext = 0;
+            queueTouchMove('X', 0);
+            queueTouchMove('Y', 0);
+            queueTouchMove('R', touchAt[PLAN_AXIS_R] + rotaryShortest(touchAt[PLAN_AXIS_R], 0));
+            plannerSetTag(NO_CHECKPOINT_TAG);
+            continue;
+        }
+        if (touchSide != motionSide) {
+            applySide(touchSide);
+            // No corners rounded into a run: it starts and ends at rest on its row line
+            plannerSetCornerBlend(PLAN_AXIS_X, 0);
+            plannerSetCornerBlend(PLAN_AXIS_Y, 0);
         }
+        plannerSetTag(TOUCHUP_TAG | touchSide);
+        queueTouchGap(gap);
+    }
+}
+
+void processStream() {
+    Command cmd;
+    while (!plannerFull() && jobStreamPop(cmd)) {
+        executeCommand(cmd);
     }
     
+    if (jobStreamFinished()) {
+        systemState = CYCLE_COMPLETE;
+    }
+}
+
+void printTasks() {
+    for (uint8_t i = 0; i < schedulerTaskCount(); i++) {
+        const SchedulerStats& s = schedulerStats(i);
+        Serial.print(schedulerTask(i).name);
+        Serial.print(F(": "));
+        Serial.print(s.runs);
+        Serial.print(F(" runs, avg "));
+        Serial.print(s.runs ? s.totalUs / s.runs : 0);
+        Serial.print(F(" us, max "));
+        Serial.print(s.maxUs);
+        Serial.print(F(" us, budget "));
+        Serial.print(schedulerTask(i).budgetUs);
+        Serial.print(F(" us, "));
+        Serial.print(s.overruns);
+        Serial.print(F(" overruns, "));
+        Serial.print(s.deferrals);
+        Serial.println(F(" deferred"));
+    }
+}
+
+// Planner and state machine: keeps the step engine queues fed
+void motionTask() {
+    uint32_t sectionStart = micros();
+    plannerUpdate();
+    timingAddSection(TIMING_PLANNER, micros() - sectionStart);
+    
+    // Paint landing on the side the running move belongs to
+    PlanProgress progress;
+    coverageUpdate(plannerProgress(progress) ? tagSide(progress.tag) : -1,
+                   stepperX.currentPosition(), stepperY.currentPosition(), stepEngineRelayOpen());
+    
+    motorsRunning = stepperX.isRunning() || 
+                   stepperY.isRunning() || 
+                   stepperRotation.isRunning() ||
+                   stepEngineLineActive() ||
+                   !plannerIdle();
+    
     switch(systemState) {
         case IDLE:
             break;
             
-        case HOMING_X:
-            if (!xHomeSensor.read()) {
-                stepperX.setCurrentPosition(0);
-                systemState = HOMING_Y;
-            } else if (!stepperX.isRunning()) {
-                stepperX.moveTo(-1000000);
-            }
-            break;
-            
-        case HOMING_Y:
-            if (!yHomeSensor.read()) {
-                stepperY.setCurrentPosition(0);
+        case HOMING:
+            homingUpdate();
+            if (homingDone() && resumePending) {
+                homingAbort();
+                resumePending = false;
+                startResume();
+            } else if (homingDone() && batchRunning) {
+                homingAbort();
+                canvasesSinceHome = 0;
+                if (batchLoaded) {
+                    startBatchCanvas();
+                } else {
+                    systemState = BATCH_WAITING;
+                }
+            } else if (homingDone()) {
+                homingAbort();
                 systemState = HOMED_WAITING;  // Changed to new waiting state
                 Serial.println(F("Homing complete. Enter 'S' to start painting."));
-            } else if (!stepperY.isRunning()) {
-                stepperY.moveTo(-1000000);
+            } else if (homingFailed()) {
+                homingAbort();
+                resumePending = false;
+                batchRunning = false;
+                stepperX.stop();
+                stepperY.stop();
+                systemState = ERROR;
+                Serial.println(F("Homing failed"));
             }
             break;
             
@@ -535,17 +1979,148 @@ void loop() {
             break;
             
         case EXECUTING_PATTERN:
+            sectionStart = micros();
             processPattern();
+            timingAddSection(TIMING_PATTERN, micros() - sectionStart);
+            break;
+            
+        case STREAMING_JOB:
+            sectionStart = micros();
+            processStream();
+            timingAddSection(TIMING_PATTERN, micros() - sectionStart);
             break;
             
         case ERROR:
             break;
             
+        case BATCH_WAITING:
+            break;
+            
+        case CHECKING_HOME:
+            homingUpdate();
+            if (homingDone()) {
+                finishHomeCheck();
+            } else if (homingFailed()) {
+                // Position can no longer be trusted
+                homingAbort();
+                stepperX.stop();
+                stepperY.stop();
+                stepperX.setMaxSpeed(homeCheckSpeed[0]);
+                stepperY.setMaxSpeed(homeCheckSpeed[1]);
+                batchRunning = false;
+                systemState = ERROR;
+                Serial.println(F("Home check failed, steps lost beyond the check range"));
+            }
+            break;
+            
+        case PAUSED:
+            // No re-homing, the position was never lost
+            if (resumePending && !motorsRunning) {
+                resumePending = false;
+                startResume();
+            }
+            break;
+            
+        case PRIMING:
+        case CLEANING:
+            processPurge();
+            break;
+            
+        case TUNING:
+            autotuneUpdate();
+            if (autotuneDone()) {
+                finishTune();
+            } else if (autotuneFailed()) {
+                stepperX.stop();
+                stepperY.stop();
+                systemState = ERROR;
+                Serial.println(F("Tune failed: home switch not found"));
+            }
+            break;
+            
+        case TOUCHING_UP:
+            sectionStart = micros();
+            processTouchUp();
+            timingAddSection(TIMING_PATTERN, micros() - sectionStart);
+            break;
+            
         case CYCLE_COMPLETE:
             if (!motorsRunning) {
                 Serial.println(F("Cycle complete"));
+                queueCheckpoint(CHECKPOINT_STATUS_CLEAR);
+                if (jobActive) logJob(true);
                 systemState = IDLE;
+                if (batchRunning) nextBatchCanvas();
             }
             break;
     }
+}
+
+// The relay may only be open while a job is moving or a purge cycle runs
+void safetyTask() {
+    estopPoll();
+    if (estopTripped() && !estopHandled) {
+        // Steps stopped in the interrupt, the planner still holds the move that was running
+        estopHandled = true;
+        const long* p = estopPositions();
+        Serial.print(F("E-stop at X "));
+        Serial.print(p[0]);
+        Serial.print(F(", Y "));
+        Serial.print(p[1]);
+        Serial.print(F(", R "));
+        Serial.println(p[2]);
+        stopMachine();
+    }
+    if (!estopTripped()) estopHandled = false;
+    
+    if (stepEngineSprayOn() && !jobRunning() && systemState != STREAMING_JOB && systemState != TOUCHING_UP &&
+        !purgeSpraying()) {
+        stepEngineSetSpray(false);
+        stepEngineClearSprayWindow();
+        Serial.println(F("Spray interlock: relay closed"));
+    }
+}
+
+void commandTask() {
+    // Never blocks: bytes are consumed as they arrive
+    uint32_t sectionStart = micros();
+    FramePoll framePoll = frameReader.poll();
+    if (framePoll == FRAME_READY) {
+        handleFrame(frameReader.frame());
+    } else if (framePoll == FRAME_BAD) {
+        frameSendText(Serial, FRAME_REJECT, "frame dropped");
+    } else if (!frameReader.receiving() && serialReader.poll()) {
+        // A frame that did not fit this pass finishes on the next. A line too
+        // long for the reader still gets its one reply, streamed or not.
+        if (serialReader.overflowed()) {
+            Serial.println(F("error: line too long"));
+        } else {
+            handleSerialLine(serialReader.line(), serialReader.length());
+        }
+    }
+    if (statusFramePeriod > 0 && millis() - lastStatusFrame >= statusFramePeriod) sendStatusFrame();
+    timingAddSection(TIMING_SERIAL, micros() - sectionStart);
+}
+
+void persistenceTask() {
+    serviceCheckpoint();
+}
+
+void telemetryTask() {
+    // Slower polling and no connecting outside the resting states, see telemetry.h.
+    // Homing, tuning and home checks stand still between moves and a purge
+    // holds the gun open, so those never count as idle.
+    uint32_t sectionStart = micros();
+    bool resting = (systemState == IDLE || systemState == HOMED_WAITING ||
+                    systemState == BATCH_WAITING || systemState == ERROR) &&
+                   !purgeActive() && !motorsRunning;
+    telemetryService(resting);
+    timingAddSection(TIMING_NETWORK, micros() - sectionStart);
+}
+
+void loop() {
+    timingLoopStart();
+    SystemState passState = systemState;
+    schedulerRun();
+    timingLoopEnd(passState);
 }
\ No newline at end of file
@@ -0,0 +1,653 @@
+#include "planner.h"
+#include "scurve.h"
+#include "shaper.h"
+
+static const uint8_t PLAN_EVENT = 0xFF;      // Spray change that could not attach to a move
+static const uint8_t PLAN_LINE = 0xFE;       // Coordinated move on all axes
+static const uint8_t PLAN_WINDOW = 0xFD;     // Spray window change, steps = width in X (0 = clear)
+static const uint8_t RAMP_PHASES = 5;        // S-curve or shaped ramp, at most
+static const uint8_t SPLIT_BLOCKS = 2 * RAMP_PHASES + 1;   // Most blocks one move is split into
+
+struct PlanBlock {
+    uint8_t axis;
+    int32_t steps;            // Single axis moves, or the major axis of a line
+    int32_t line[PLAN_AXIS_COUNT];
+    float maxSpeed;
+    float accel;
+    float exitSpeed;
+    int32_t blendSteps;
+    int8_t startSpray;
+    int8_t endSpray;
+    float openLead;           // Seconds the relay opens ahead of this move
+    float closeLead;          // Seconds the relay closes ahead of this move's end
+    bool leadHandled;         // Opening was already scheduled on the previous move
+    bool sprayHeld;           // Queued with the spray on
+    bool windowed;            // Queued inside a spray window
+    bool split;               // One phase of an S-curve or shaped move
+    bool issued;
+    uint32_t sequence;        // Segment number on its axis once issued
+    uint32_t tag;             // Caller's job position, see plannerSetTag()
+    int32_t tagSteps;         // Steps of the same command in the blocks before it (S-curve splits)
+    int32_t from[PLAN_AXIS_COUNT];   // Planned start positions once issued
+};
+
+struct AxisLimits {
+    float speed;              // Dry moves
+    float accel;
+    float spraySpeed;         // Moves made with the spray on
+    float sprayAccel;
+    float jerk;               // Dry moves, 0 = trapezoid
+    Shaper shaper;            // All moves, see shaper.h
+};
+
+static StepAxis* planAxes[PLAN_AXIS_COUNT];
+static AxisLimits limits[PLAN_AXIS_COUNT];
+static uint32_t issuedSegments[PLAN_AXIS_COUNT];
+static uint32_t issuedLines = 0;
+static int32_t lastIssuedTarget[PLAN_AXIS_COUNT];
+
+static float sprayOpenLead = 0;
+static float sprayCloseLead = 0;
+static bool leadOpened = false;          // Relay opened for a pass still held back
+static unsigned long leadOpenedAt = 0;
+static bool windowSet = false;           // Relay gated by X position, leads live in the window
+static uint32_t currentTag = 0;
+static bool sprayQueued = false;         // Spray state at the tail of the queue
+static bool windowQueued = false;        // Spray window state at the tail of the queue
+static float cornerBlend[PLAN_AXIS_COUNT] = {PLANNER_CORNER_BLEND, PLANNER_CORNER_BLEND, PLANNER_CORNER_BLEND};
+
+static PlanBlock blocks[PLANNER_DEPTH];
+static uint8_t head = 0;
+static uint8_t count = 0;
+
+static PlanBlock& blockAt(uint8_t i) {
+    return blocks[(head + i) % PLANNER_DEPTH];
+}
+
+static bool isMotion(const PlanBlock& b) {
+    return b.axis != PLAN_EVENT && b.axis != PLAN_WINDOW;
+}
+
+static bool isLine(const PlanBlock& b) {
+    return b.axis == PLAN_LINE;
+}
+
+static bool isAxisMove(const PlanBlock& b) {
+    return b.axis < PLAN_AXIS_COUNT;
+}
+
+static bool blockComplete(const PlanBlock& b) {
+    if (!b.issued) return false;
+    if (!isMotion(b)) return true;
+    if (isLine(b)) return stepEngineLinesCompleted() > b.sequence;
+    return planAxes[b.axis]->completedSegments() > b.sequence;
+}
+
+void plannerBegin(StepAxis* x, StepAxis* y, StepAxis* r) {
+    planAxes[PLAN_AXIS_X] = x;
+    planAxes[PLAN_AXIS_Y] = y;
+    planAxes[PLAN_AXIS_R] = r;
+    for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) {
+        limits[a].speed = planAxes[a]->maxSpeed();
+        limits[a].accel = planAxes[a]->acceleration();
+        limits[a].spraySpeed = limits[a].speed;
+        limits[a].sprayAccel = limits[a].accel;
+        limits[a].jerk = 0;
+        limits[a].shaper = shaperMake(SHAPER_OFF, 0, 0);
+    }
+    plannerClear();
+}
+
+void plannerSetLimits(uint8_t axis, float speed, float accel) {
+    if (axis >= PLAN_AXIS_COUNT) return;
+    limits[axis].speed = speed;
+    limits[axis].spraySpeed = speed;
+    limits[axis].sprayAccel = accel;
+    if (limits[axis].accel != accel) {
+        limits[axis].accel = accel;
+        planAxes[axis]->setAcceleration(accel);
+    }
+}
+
+void plannerSetSprayLimits(uint8_t axis, float speed, float accel) {
+    if (axis >= PLAN_AXIS_COUNT) return;
+    limits[axis].spraySpeed = speed;
+    limits[axis].sprayAccel = accel;
+}
+
+void plannerSetJerk(uint8_t axis, float jerk) {
+    if (axis >= PLAN_AXIS_COUNT) return;
+    limits[axis].jerk = max(jerk, 0.0f);
+}
+
+void plannerSetShaper(uint8_t axis, const Shaper& shaper) {
+    if (axis >= PLAN_AXIS_COUNT) return;
+    limits[axis].shaper = shaper;
+}
+
+static float axisSpeed(uint8_t axis) {
+    return sprayQueued ? limits[axis].spraySpeed : limits[axis].speed;
+}
+
+static float axisAccel(uint8_t axis) {
+    return sprayQueued ? limits[axis].sprayAccel : limits[axis].accel;
+}
+
+void plannerSetSprayLead(float openMs, float closeMs) {
+    sprayOpenLead = max(openMs, 0.0f) / 1000.0f;
+    sprayCloseLead = max(closeMs, 0.0f) / 1000.0f;
+}
+
+void plannerSetTag(uint32_t tag) {
+    currentTag = tag;
+}
+
+void plannerSetCornerBlend(uint8_t axis, float blend) {
+    if (axis >= PLAN_AXIS_COUNT) return;
+    cornerBlend[axis] = constrain(blend, 0.0f, 1.0f);
+}
+
+// Backward pass over the blocks not yet handed to the engine: each block may
+// leave at the junction speed only if the following same-axis, same-direction
+// block can still brake to its own exit speed.
+static void recalculate() {
+    float nextExit = 0;
+    for (int i = count - 1; i >= 0; i--) {
+        PlanBlock& b = blockAt(i);
+        if (b.issued) break;
+        if (!isMotion(b)) {
+            nextExit = 0;
+            continue;
+        }
+        b.exitSpeed = 0;
+        if (i + 1 < count) {
+            const PlanBlock& n = blockAt(i + 1);
+            if (isAxisMove(b) && n.axis == b.axis && (n.steps > 0) == (b.steps > 0)) {
+                float junction = min(b.maxSpeed, n.maxSpeed);
+                float reachable = sqrtf(nextExit * nextExit + 2.0f * n.accel * labs(n.steps));
+                b.exitSpeed = min(junction, reachable);
+            }
+        }
+        nextExit = b.exitSpeed;
+    }
+}
+
+static void push(const PlanBlock& b) {
+    if (count >= PLANNER_DEPTH) return;
+    blocks[(head + count) % PLANNER_DEPTH] = b;
+    count++;
+    recalculate();
+}
+
+static PlanBlock newBlock(uint8_t axis) {
+    PlanBlock b;
+    b.axis = axis;
+    b.steps = 0;
+    for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) b.line[a] = 0;
+    b.maxSpeed = 0;
+    b.accel = 0;
+    b.exitSpeed = 0;
+    b.blendSteps = 0;
+    b.startSpray = SPRAY_KEEP;
+    b.endSpray = SPRAY_KEEP;
+    b.openLead = sprayOpenLead;
+    b.closeLead = sprayCloseLead;
+    b.leadHandled = false;
+    b.sprayHeld = sprayQueued;
+    b.windowed = windowQueued;
+    b.split = false;
+    b.issued = false;
+    b.sequence = 0;
+    b.tag = currentTag;
+    b.tagSteps = 0;
+    for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) b.from[a] = 0;
+    return b;
+}
+
+// One phase from `done` to `to`, between the speeds at its boundaries. The
+// acceleration comes from the whole-step length, so rounding the boundaries
+// never leaves a phase too short to reach its exit speed.
+static void pushPhase(PlanBlock& b, long& done, long to, float& speed, float exitSpeed, float cruiseAccel) {
+    if (to <= done) return;
+    bool reverse = b.steps < 0;
+    long steps = to - done;
+    float change = fabsf(exitSpeed * exitSpeed - speed * speed);
+    b.steps = reverse ? -steps : steps;
+    b.tagSteps = done;
+    b.maxSpeed = max(max(speed, exitSpeed), 1.0f);
+    b.accel = change > 1.0f ? change / (2.0f * steps) : cruiseAccel;
+    b.split = true;
+    push(b);
+    b.startSpray = SPRAY_KEEP;     // Only the first block starts anything
+    done = to;
+    speed = exitSpeed;
+}
+
+// A rest-to-rest move as constant-acceleration blocks: the ramp phases up to
+// the cruise, the cruise, then the same phases braking. Positions at the
+// phase boundaries are whole steps, rounded down so the two ramps never
+// overlap.
+static void pushSplit(const PlanBlock& move, const float accel[], const float seconds[], uint8_t phases,
+                      float cruiseSpeed, float cruiseAccel) {
+    long distance = labs(move.steps);
+
+    // Ramp up from the start, and the stop backwards from the end
+    float up[RAMP_PHASES + 1] = {0};
+    long upAt[RAMP_PHASES + 1] = {0};
+    float down[RAMP_PHASES + 1] = {0};
+    long downAt[RAMP_PHASES + 1] = {0};
+    float position = 0;
+    for (uint8_t k = 0; k < phases; k++) {
+        position += up[k] * seconds[k] + accel[k] * seconds[k] * seconds[k] / 2.0f;
+        up[k + 1] = up[k] + accel[k] * seconds[k];
+        upAt[k + 1] = min((long)position, distance / 2);
+    }
+    position = 0;
+    for (int k = phases - 1; k >= 0; k--) {
+        position += down[k + 1] * seconds[k] + accel[k] * seconds[k] * seconds[k] / 2.0f;
+        down[k] = down[k + 1] + accel[k] * seconds[k];
+        downAt[k] = min((long)position, distance / 2);
+    }
+
+    PlanBlock b = move;
+    long done = 0;
+    float speed = 0;
+    for (uint8_t k = 0; k < phases; k++) pushPhase(b, done, upAt[k + 1], speed, up[k + 1], cruiseAccel);
+    pushPhase(b, done, distance - downAt[0], speed, cruiseSpeed, cruiseAccel);
+    for (uint8_t k = 0; k < phases; k++) pushPhase(b, done, distance - downAt[k + 1], speed, down[k + 1], cruiseAccel);
+
+    // Later moves on other axes may overlap part of the stop, see canIssue()
+    PlanBlock& last = blockAt(count - 1);
+    last.blendSteps = (int32_t)(downAt[0] * cornerBlend[move.axis]);
+}
+
+// S-curve ramp as five phases: the two halves of the first jerk phase at
+// 1/4 and 3/4 of the peak acceleration, the constant part, then the second
+// jerk phase the other way round. Each phase gains the same speed as the
+// real jerk phase, so the peak speed and the ramp length match the S-curve.
+static void pushSCurve(const PlanBlock& move, float jerk) {
+    SCurve c = scurvePlan(labs(move.steps), move.maxSpeed, move.accel, jerk);
+    float accel[5] = {0.25f * c.peakAccel, 0.75f * c.peakAccel, c.peakAccel, 0.75f * c.peakAccel, 0.25f * c.peakAccel};
+    float seconds[5] = {c.jerkTime / 2, c.jerkTime / 2, c.accelTime, c.jerkTime / 2, c.jerkTime / 2};
+    pushSplit(move, accel, seconds, 5, c.peakSpeed, c.peakAccel);
+}
+
+static void pushShaped(const PlanBlock& move, const Shaper& shaper) {
+    ShapedMove m = shaperPlan(shaper, labs(move.steps), move.maxSpeed, move.accel);
+    pushSplit(move, m.accel, m.seconds, m.phases, m.peakSpeed, move.accel);
+}
+
+// A SPRAY_ON waiting at the tail opens the relay as the next move starts
+static int8_t takeStartSpray(bool sprayOn) {
+    int8_t startSpray = sprayOn ? SPRAY_SET_ON : SPRAY_KEEP;
+    if (count > 0) {
+        PlanBlock& last = blockAt(count - 1);
+        if (!last.issued && last.axis == PLAN_EVENT && last.startSpray == SPRAY_SET_ON) {
+            count--;
+            startSpray = SPRAY_SET_ON;
+        }
+    }
+    return startSpray;
+}
+
+void plannerMove(uint8_t axis, long steps, bool sprayOn) {
+    if (axis >= PLAN_AXIS_COUNT) return;
+
+    int8_t startSpray = takeStartSpray(sprayOn);
+    if (steps == 0) {
+        if (startSpray != SPRAY_KEEP) plannerSpray(true);
+        return;
+    }
+    if (startSpray == SPRAY_SET_ON) sprayQueued = true;
+
+    PlanBlock b = newBlock(axis);
+    b.steps = steps;
+    b.maxSpeed = axisSpeed(axis);
+    b.accel = axisAccel(axis);
+    b.startSpray = startSpray;
+
+    if (shaperActive(limits[axis].shaper)) {
+        pushShaped(b, limits[axis].shaper);
+        return;
+    }
+    if (limits[axis].jerk > 0 && !sprayQueued) {
+        pushSCurve(b, limits[axis].jerk);
+        return;
+    }
+
+    // Overlap window: part of the ramp down from the peak a rest-to-rest
+    // profile of this length reaches
+    float distance = labs(steps);
+    float peak2 = min(b.maxSpeed * b.maxSpeed, b.accel * distance);
+    float ramp = b.accel > 0 ? peak2 / (2.0f * b.accel) : 0;
+    b.blendSteps = (int32_t)min(ramp * cornerBlend[axis], distance);
+
+    push(b);
+}
+
+void plannerLine(const long steps[PLAN_AXIS_COUNT], bool sprayOn) {
+    uint8_t moving = 0;
+    uint8_t only = 0;
+    long major = 0;
+    for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) {
+        if (steps[a] != 0) {
+            moving++;
+            only = a;
+        }
+        major = max(major, labs(steps[a]));
+    }
+    if (moving <= 1) {
+        plannerMove(only, steps[only], sprayOn);
+        return;
+    }
+
+    PlanBlock b = newBlock(PLAN_LINE);
+    b.startSpray = takeStartSpray(sprayOn);
+    if (b.startSpray == SPRAY_SET_ON) sprayQueued = true;
+    b.steps = major;
+
+    // Major-axis speed and accel such that no axis exceeds its own limits
+    b.maxSpeed = 1e9;
+    b.accel = 1e9;
+    for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) {
+        b.line[a] = steps[a];
+        if (steps[a] == 0) continue;
+        float scale = (float)major / labs(steps[a]);
+        b.maxSpeed = min(b.maxSpeed, axisSpeed(a) * scale);
+        b.accel = min(b.accel, axisAccel(a) * scale);
+    }
+    push(b);
+}
+
+// On a split move the close lead can reach back past the last phase: the
+// close goes on the phase it falls in, with the rest of the lead
+static void closeAtEnd() {
+    uint8_t i = count - 1;
+    float lead = blockAt(i).closeLead;
+    while (lead > 0 && i > 0) {
+        const PlanBlock& b = blockAt(i);
+        const PlanBlock& prev = blockAt(i - 1);
+        if (!b.split || b.tagSteps == 0 || prev.issued) break;
+        float seconds = 2.0f * labs(b.steps) / max(prev.exitSpeed + b.exitSpeed, 1.0f);
+        if (lead <= seconds) break;
+        lead -= seconds;
+        i--;
+    }
+    PlanBlock& b = blockAt(i);
+    b.endSpray = SPRAY_SET_OFF;
+    b.closeLead = lead;
+}
+
+void plannerSpray(bool on) {
+    sprayQueued = on;
+    if (!on && count > 0) {
+        // SPRAY_OFF closes the relay exactly where the preceding move ends
+        PlanBlock& last = blockAt(count - 1);
+        if (!last.issued && isMotion(last)) {
+            closeAtEnd();
+            return;
+        }
+        if (!last.issued && last.axis == PLAN_EVENT) {
+            last.startSpray = SPRAY_SET_OFF;
+            return;
+        }
+    }
+
+    PlanBlock b = newBlock(PLAN_EVENT);
+    b.startSpray = on ? SPRAY_SET_ON : SPRAY_SET_OFF;
+    push(b);
+}
+
+void plannerSprayWindow(long width, bool enable) {
+    windowQueued = enable && width != 0;
+    PlanBlock b = newBlock(PLAN_WINDOW);
+    b.steps = enable ? width : 0;
+    b.maxSpeed = limits[PLAN_AXIS_X].spraySpeed;   // The passes it gates run with the spray on
+    push(b);
+}
+
+static bool allCompleteBefore(uint8_t index) {
+    for (uint8_t i = 0; i < index; i++) {
+        if (!blockComplete(blockAt(i))) return false;
+    }
+    return true;
+}
+
+static bool axisBusy(uint8_t axis) {
+    return issuedSegments[axis] > planAxes[axis]->completedSegments();
+}
+
+static bool anyAxisBusy() {
+    for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) {
+        if (axisBusy(a) || planAxes[a]->isRunning()) return true;
+    }
+    return stepEngineLineActive();
+}
+
+// Overlapping two moves on different axes runs both at once, so it is only
+// done where the relay cannot be open: between dry moves, or between moves
+// the spray is held through while a window gates the relay by X position
+static bool canBlend(const PlanBlock& prev, const PlanBlock& b) {
+    if (prev.endSpray == SPRAY_SET_OFF || b.startSpray == SPRAY_SET_ON) return false;
+    if (!prev.sprayHeld && !b.sprayHeld) return true;
+    return prev.sprayHeld && b.sprayHeld && prev.windowed && b.windowed;
+}
+
+static bool canIssue(uint8_t index) {
+    const PlanBlock& b = blockAt(index);
+    if (isLine(b)) {
+        return allCompleteBefore(index) && !anyAxisBusy();
+    }
+    if (index == 0) {
+        return !isMotion(b) || (!axisBusy(b.axis) && !stepEngineLineActive());
+    }
+
+    const PlanBlock& prev = blockAt(index - 1);
+    if (!isMotion(b) || !isAxisMove(prev)) {
+        return allCompleteBefore(index);
+    }
+
+    if (prev.axis == b.axis) {
+        // Continues on the same axis, goes straight into the engine queue
+        return prev.issued && !planAxes[b.axis]->queueFull();
+    }
+
+    // Different axis: start once the previous move is inside its blend window,
+    // which on a split move reaches back over its last phases
+    if (!canBlend(prev, b)) return allCompleteBefore(index);
+    uint8_t first = index - 1;
+    while (first > 0 && blockAt(first).split && blockAt(first).tagSteps > 0) first--;
+    if (!allCompleteBefore(first) || !prev.issued || axisBusy(b.axis)) {
+        return false;
+    }
+    if (blockComplete(prev)) return true;
+    StepAxis* p = planAxes[prev.axis];
+    if (p->completedSegments() < blockAt(first).sequence) return false;
+    long end = prev.from[prev.axis] + prev.steps;
+    return labs(end - p->currentPosition()) <= prev.blendSteps;
+}
+
+// Remaining distance at which the axis is `lead` seconds away from having
+// `until` steps left, on a profile cruising at vc and braking to ve
+static float leadDistance(float vc, float ve, float accel, float until, float lead) {
+    float vu = min(sqrtf(ve * ve + 2.0f * accel * until), vc);
+    float brakeTime = (vc - vu) / accel;
+    if (lead <= brakeTime) {
+        float v = vu + accel * lead;
+        return until + (v * v - vu * vu) / (2.0f * accel);
+    }
+    return until + (vc * vc - vu * vu) / (2.0f * accel) + vc * (lead - brakeTime);
+}
+
+// Where the end-of-move spray action of block `index` fires. Also pulls the
+// opening for the next pass forward onto this move when there is a lead.
+static long sprayEndLead(uint8_t index, int8_t& action) {
+    PlanBlock& b = blockAt(index);
+    action = b.endSpray;
+
+    float lead = 0;
+    if (action == SPRAY_SET_OFF) {
+        lead = b.closeLead;
+    } else if (action == SPRAY_KEEP && index + 1 < count) {
+        PlanBlock& n = blockAt(index + 1);
+        if (isMotion(n) && n.startSpray == SPRAY_SET_ON && n.openLead > 0) {
+            // A pass never blends in (canBlend), so it starts at our end
+            lead = n.openLead;
+            action = SPRAY_SET_ON;
+            n.leadHandled = true;
+        }
+    }
+    if (lead <= 0 || b.accel <= 0 || windowSet) return 0;
+
+    float entry = 0;
+    if (index > 0 && blockAt(index - 1).axis == b.axis) entry = blockAt(index - 1).exitSpeed;
+    float distance = labs(b.steps);
+    float peak = sqrtf((2.0f * b.accel * distance + entry * entry + b.exitSpeed * b.exitSpeed) / 2.0f);
+    float vc = min(b.maxSpeed, peak);
+    return (long)min(leadDistance(vc, b.exitSpeed, b.accel, 0, lead), distance);
+}
+
+// A pass starting from rest gets its lead by holding the move back
+static bool holdForLead(PlanBlock& b) {
+    if (b.startSpray != SPRAY_SET_ON || b.openLead <= 0 || b.leadHandled || windowSet) return false;
+    if (!leadOpened) {
+        stepEngineSetSpray(true);
+        leadOpened = true;
+        leadOpenedAt = micros();
+        return true;
+    }
+    if (micros() - leadOpenedAt < (unsigned long)(b.openLead * 1e6f)) return true;
+    leadOpened = false;
+    return false;
+}
+
+static void issue(uint8_t index) {
+    PlanBlock& b = blockAt(index);
+    if (b.axis == PLAN_WINDOW) {
+        // Everything before has finished, so X stands where the window starts
+        windowSet = b.steps != 0;
+        if (windowSet) {
+            long from = planAxes[PLAN_AXIS_X]->targetPosition();
+            stepEngineSetSprayWindow(planAxes[PLAN_AXIS_X], from, from + b.steps,
+                                     (long)(b.maxSpeed * b.openLead), (long)(b.maxSpeed * b.closeLead));
+        } else {
+            stepEngineClearSprayWindow();
+        }
+        b.issued = true;
+        return;
+    }
+    if (!isMotion(b)) {
+        stepEngineSetSpray(b.startSpray == SPRAY_SET_ON);
+        b.issued = true;
+        return;
+    }
+
+    if (holdForLead(b)) return;
+
+    if (isLine(b)) {
+        long steps[PLAN_AXIS_COUNT];
+        for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) {
+            steps[a] = b.line[a];
+            b.from[a] = planAxes[a]->targetPosition();
+        }
+        if (!stepEngineLine(planAxes, steps, PLAN_AXIS_COUNT, b.maxSpeed, b.accel, b.startSpray, b.endSpray)) {
+            return;
+        }
+        b.sequence = issuedLines++;
+        for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) lastIssuedTarget[a] += b.line[a];
+        b.issued = true;
+        return;
+    }
+
+    StepAxis* axis = planAxes[b.axis];
+    int32_t from = axisBusy(b.axis) ? lastIssuedTarget[b.axis] : axis->targetPosition();
+    int32_t to = from + b.steps;
+    int8_t endAction;
+    long endLead = sprayEndLead(index, endAction);
+    if (!axis->queueSegment(to, b.maxSpeed, b.exitSpeed, b.startSpray, endAction, endLead, b.accel)) {
+        return;
+    }
+    b.sequence = issuedSegments[b.axis]++;
+    lastIssuedTarget[b.axis] = to;
+    b.from[b.axis] = from;
+    b.issued = true;
+}
+
+void plannerUpdate() {
+    // Retire finished blocks
+    while (count > 0 && blockComplete(blockAt(0))) {
+        head = (head + 1) % PLANNER_DEPTH;
+        count--;
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        PlanBlock& b = blockAt(i);
+        if (b.issued) continue;
+        if (!canIssue(i)) break;
+        issue(i);
+        if (!b.issued) break;
+    }
+}
+
+void plannerClear() {
+    head = 0;
+    count = 0;
+    leadOpened = false;
+    windowSet = false;
+    sprayQueued = false;
+    windowQueued = false;
+    stepEngineClearSprayWindow();
+    for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) {
+        issuedSegments[a] = planAxes[a] ? planAxes[a]->completedSegments() : 0;
+        lastIssuedTarget[a] = planAxes[a] ? planAxes[a]->targetPosition() : 0;
+    }
+    // A stopped line may still be braking: number on from the lines started,
+    // so the next one is not counted complete when the braking one ends
+    issuedLines = stepEngineLinesStarted();
+}
+
+bool plannerProgress(PlanProgress& progress) {
+    // Oldest move still running or waiting; blocks ahead of it are done
+    uint8_t first = 0;
+    while (first < count && (!isMotion(blockAt(first)) || blockComplete(blockAt(first)))) first++;
+    if (first >= count) return false;
+
+    const PlanBlock& b = blockAt(first);
+    progress.tag = b.tag;
+    progress.stepsDone = 0;
+    for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) {
+        progress.resume[a] = planAxes[a]->currentPosition();
+    }
+
+    if (isAxisMove(b) && b.issued && planAxes[b.axis]->completedSegments() == b.sequence) {
+        // Running: count what is done along it
+        long done = planAxes[b.axis]->currentPosition() - b.from[b.axis];
+        if (b.steps < 0) done = -done;
+        progress.stepsDone = constrain(done, 0L, labs(b.steps));
+    } else if (b.issued) {
+        for (uint8_t a = 0; a < PLAN_AXIS_COUNT; a++) progress.resume[a] = b.from[a];
+    }
+    if (isAxisMove(b) && b.issued) {
+        progress.resume[b.axis] = b.from[b.axis] + (b.steps < 0 ? -progress.stepsDone : progress.stepsDone);
+    }
+    progress.stepsDone += b.tagSteps;
+
+    // Undo what later blocks, blended in early, already moved on other axes
+    bool seen[PLAN_AXIS_COUNT] = {false, false, false};
+    if (isAxisMove(b)) seen[b.axis] = true;
+    for (uint8_t i = first + 1; i < count; i++) {
+        const PlanBlock& n = blockAt(i);
+        if (!n.issued || !isAxisMove(n) || seen[n.axis]) continue;
+        progress.resume[n.axis] = n.from[n.axis];
+        seen[n.axis] = true;
+    }
+    return true;
+}
+
+bool plannerFull() {
+    return count + SPLIT_BLOCKS > PLANNER_DEPTH;
+}
+
+bool plannerIdle() {
+    return count == 0;
+}
@@ -0,0 +1,76 @@
+#include "purge.h"
+#include "config.h"
+#include "step_engine.h"
+
+enum PurgePhase {
+    PURGE_IDLE,
+    PURGE_WAITING,       // Head not in the zone yet
+    PURGE_OPEN,
+    PURGE_DONE
+};
+
+static uint8_t flushValve = 0;
+static PurgePhase phase = PURGE_IDLE;
+static PurgeCycle cycle = PURGE_PRIME;
+static unsigned long openedAt = 0;
+
+static void setValves(bool open) {
+    stepEngineSetSpray(open);
+    digitalWrite(flushValve, open && cycle == PURGE_CLEAN ? HIGH : LOW);
+}
+
+void purgeBegin(uint8_t flushPin) {
+    flushValve = flushPin;
+    pinMode(flushValve, OUTPUT);
+    digitalWrite(flushValve, LOW);
+}
+
+void purgeStart(PurgeCycle c) {
+    cycle = c;
+    phase = PURGE_WAITING;
+}
+
+void purgeUpdate(bool inZone) {
+    switch (phase) {
+        case PURGE_WAITING:
+            if (!inZone) break;
+            setValves(true);
+            openedAt = millis();
+            phase = PURGE_OPEN;
+            break;
+
+        case PURGE_OPEN:
+            if (millis() - openedAt < (cycle == PURGE_PRIME ? PURGE_PRIME_MS : PURGE_CLEAN_MS)) break;
+            setValves(false);
+            phase = PURGE_DONE;
+            break;
+
+        default:
+            break;
+    }
+}
+
+void purgeAbort() {
+    if (phase == PURGE_OPEN) setValves(false);
+    phase = PURGE_IDLE;
+}
+
+bool purgeActive() {
+    return phase == PURGE_WAITING || phase == PURGE_OPEN;
+}
+
+bool purgeSpraying() {
+    return phase == PURGE_OPEN;
+}
+
+bool purgeDone() {
+    return phase == PURGE_DONE;
+}
+
+bool purgeInZone(long x, long y) {
+    return labs(x) <= PURGE_ZONE_INCHES * X_STEPS_PER_INCH && labs(y) <= PURGE_ZONE_INCHES * Y_STEPS_PER_INCH;
+}
+
+PurgeCycle purgeCycle() {
+    return cycle;
+}
@@ -0,0 +1,157 @@
+#include "raster.h"
+#include "config.h"
+#include "rotary.h"
+
+const CanvasParams DEFAULT_CANVAS = {
+    26.0,      // width
+    35.0,      // height
+    4.16,      // stepOver12
+    4.415,     // stepOver34
+    4.5,       // offset
+    0,         // rows12 -> 8
+    0,         // rows34 -> 6
+    0          // overtravel, classic stop-and-go rows
+};
+
+static CanvasParams canvas = DEFAULT_CANVAS;
+static RasterSide sides[RASTER_SIDES];
+
+static uint8_t deriveRows(float extent, float stepOver) {
+    if (stepOver <= 0) return 1;
+    long rows = lroundf(extent / stepOver);
+    return (uint8_t)constrain(rows, 1L, 255L);
+}
+
+void rasterConfigure(const CanvasParams& params) {
+    canvas = params;
+    uint8_t rows12 = canvas.rows12 ? canvas.rows12 : deriveRows(canvas.height, canvas.stepOver12);
+    uint8_t rows34 = canvas.rows34 ? canvas.rows34 : deriveRows(canvas.width, canvas.stepOver34);
+    long pass12 = toSteps(canvas.width, X_STEPS_PER_INCH);
+    long pass34 = toSteps(canvas.height, X_STEPS_PER_INCH);
+    long over12 = toSteps(canvas.stepOver12, Y_STEPS_PER_INCH);
+    long over34 = toSteps(canvas.stepOver34, Y_STEPS_PER_INCH);
+    long offsetX = toSteps(canvas.offset, X_STEPS_PER_INCH);
+    long offsetY = toSteps(canvas.offset, Y_STEPS_PER_INCH);
+
+    long over = canvas.overtravel > 0 ? toSteps(canvas.overtravel, X_STEPS_PER_INCH) : 0;
+    long nearOverX = min(over, offsetX);   // Rows on sides 1/2 start at X = offset
+
+    // Row directions as in the original tables, leads and rotations are
+    // placed when a job is planned
+    sides[0] = {pass12, over12, rows12, false, offsetX, 0, 0, 0, 0, 0, 0, 0, nearOverX, over};
+    sides[1] = {pass12, -over12, rows12, false, offsetX, 0, rotaryQuarter(2), 0, 0, 0, 0, 0, nearOverX, over};
+    sides[2] = {pass34, over34, rows34, false, 0, offsetY, rotaryQuarter(3), 0, 0, 0, 0, 0, 0, 0};
+    sides[3] = {pass34, -over34, rows34, false, 0, offsetY, rotaryQuarter(1), 0, 0, 0, 0, 0, 0, 0};
+}
+
+const CanvasParams& rasterCanvas() {
+    return canvas;
+}
+
+const RasterSide& rasterSide(uint8_t side) {
+    return sides[side < RASTER_SIDES ? side : 0];
+}
+
+static bool racetrack(const RasterSide& s) {
+    return s.overtravelEnd > 0;
+}
+
+static long rowsDepth(const RasterSide& s) {
+    return s.rows ? (s.rows - 1) * labs(s.stepOverSteps) : 0;
+}
+
+RasterPoint rasterEntry(uint8_t side, bool reverseX, bool reverseY) {
+    const RasterSide& s = rasterSide(side);
+    return {s.edgeX + (reverseX ? s.passSteps : 0), s.edgeY + (reverseY ? rowsDepth(s) : 0)};
+}
+
+RasterPoint rasterExit(uint8_t side, bool reverseX, bool reverseY) {
+    const RasterSide& s = rasterSide(side);
+    RasterPoint p = rasterEntry(side, reverseX, reverseY);
+    long dir = reverseX ? -1 : 1;
+    p.y += reverseY ? -rowsDepth(s) : rowsDepth(s);
+    if (racetrack(s)) {
+        // Out in the overtravel where the last long pass ends
+        p.x += reverseX ? s.overtravelEnd : -s.overtravelStart;
+        if (s.rows % 2) p.x += dir * (s.passSteps + s.overtravelStart + s.overtravelEnd);
+    } else if (s.rows % 2) {
+        p.x += dir * s.passSteps;
+    }
+    return p;
+}
+
+void rasterOrient(uint8_t side, bool reverseX, bool reverseY) {
+    if (side >= RASTER_SIDES) return;
+    RasterSide& s = sides[side];
+    s.reversePasses = reverseX;
+    s.stepOverSteps = reverseY ? -labs(s.stepOverSteps) : labs(s.stepOverSteps);
+}
+
+void rasterPlace(uint8_t side, long rotation, long leadInX, long leadInY, long leadOutX, long leadOutY) {
+    if (side >= RASTER_SIDES) return;
+    RasterSide& s = sides[side];
+    s.rotationSteps = rotation;
+    s.leadInX = leadInX;
+    s.leadInY = leadInY;
+    s.leadOutX = leadOutX;
+    s.leadOutY = leadOutY;
+}
+
+static int rowOps(const RasterSide& s) {
+    if (!s.rows) return 0;
+    if (racetrack(s)) return 3 + s.rows * 2 - 1 + 2;
+    return s.rows * 4 - 1;
+}
+
+// Rows as one continuous racetrack loop, see raster.h
+static PatternOp racetrackOp(const RasterSide& s, int index) {
+    long dir = s.reversePasses ? -1 : 1;
+    long longPass = dir * (s.passSteps + s.overtravelStart + s.overtravelEnd);
+    int loopOps = s.rows * 2 - 1;
+    switch (index) {
+        case 0: return PatternOp('W', dir * s.passSteps, true);
+        case 1: return PatternOp('X', s.reversePasses ? s.overtravelEnd : -s.overtravelStart, false);
+        case 2: return PatternOp('S', 0, true);
+    }
+    index -= 3;
+    if (index < loopOps) {
+        int row = index / 2;
+        if (index % 2) return PatternOp('Y', s.stepOverSteps, false);
+        return PatternOp('X', row % 2 == 0 ? longPass : -longPass, false);
+    }
+    index -= loopOps;
+    if (index == 0) return PatternOp('S', 0, false);
+    return PatternOp('W', 0, false);
+}
+
+int rasterLength(uint8_t side) {
+    if (side >= RASTER_SIDES) return 0;
+    const RasterSide& s = sides[side];
+    return (s.rotationSteps != 0) + (s.leadInX != 0) + (s.leadInY != 0) + rowOps(s) +
+           (s.leadOutX != 0) + (s.leadOutY != 0);
+}
+
+PatternOp rasterOp(uint8_t side, int index) {
+    const RasterSide& s = rasterSide(side);
+
+    if (s.rotationSteps != 0 && index-- == 0) return PatternOp('R', s.rotationSteps, false);
+    if (s.leadInX != 0 && index-- == 0) return PatternOp('X', s.leadInX, false);
+    if (s.leadInY != 0 && index-- == 0) return PatternOp('Y', s.leadInY, false);
+
+    if (index < rowOps(s) && racetrack(s)) return racetrackOp(s, index);
+    if (index < rowOps(s)) {
+        int row = index / 4;
+        switch (index % 4) {
+            case 0:  return PatternOp('S', 0, true);
+            case 1:  return PatternOp('X', (row % 2 == 0) != s.reversePasses ? s.passSteps : -s.passSteps, true);
+            case 2:  return PatternOp('S', 0, false);
+            default: return PatternOp('Y', s.stepOverSteps, false);
+        }
+    }
+    index -= rowOps(s);
+
+    if (s.leadOutX != 0 && index-- == 0) return PatternOp('X', s.leadOutX, false);
+    if (s.leadOutY != 0 && index-- == 0) return PatternOp('Y', s.leadOutY, false);
+
+    return PatternOp('S', 0, false);
+}
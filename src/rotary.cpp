@@ -0,0 +1,23 @@
+#include "rotary.h"
+
+long rotaryWrap(long steps) {
+    long wrapped = steps % ROTATION_STEPS_PER_TURN;
+    return wrapped < 0 ? wrapped + ROTATION_STEPS_PER_TURN : wrapped;
+}
+
+uint8_t rotaryNearestQuarter(long steps) {
+    return (rotaryWrap(steps) + rotaryQuarter(1) / 2) / rotaryQuarter(1) % 4;
+}
+
+long rotaryShortest(long from, long to) {
+    long delta = rotaryWrap(to - from);
+    if (delta > ROTATION_STEPS_PER_TURN / 2) delta -= ROTATION_STEPS_PER_TURN;
+    return delta;
+}
+
+long rotaryAngleSteps(long millidegrees) {
+    // 64-bit so any number of turns converts without overflow
+    int64_t scaled = (int64_t)millidegrees * ROTATION_STEPS_PER_TURN;
+    int64_t half = scaled >= 0 ? 180000 : -180000;
+    return (long)((scaled + half) / 360000);
+}
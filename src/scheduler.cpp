@@ -0,0 +1,64 @@
+#include "scheduler.h"
+
+struct TaskState {
+    SchedulerTask task;
+    SchedulerStats stats;
+    uint32_t lastStart;
+    uint8_t deferred;          // Passes in a row the task was due but held back
+    bool started;
+};
+
+static TaskState tasks[SCHEDULER_MAX_TASKS];
+static uint8_t taskCount = 0;
+
+bool schedulerAdd(const SchedulerTask& task) {
+    if (taskCount >= SCHEDULER_MAX_TASKS) return false;
+    TaskState& t = tasks[taskCount++];
+    memset(&t, 0, sizeof(t));
+    t.task = task;
+    return true;
+}
+
+void schedulerRun() {
+    uint32_t passStart = micros();
+    for (uint8_t i = 0; i < taskCount; i++) {
+        TaskState& t = tasks[i];
+        uint32_t now = micros();
+        if (t.started && now - t.lastStart < t.task.periodUs) continue;
+
+        // The highest priority task always runs
+        if (i > 0 && now - passStart >= SCHEDULER_PASS_BUDGET_US && t.deferred < SCHEDULER_MAX_DEFERRALS) {
+            t.deferred++;
+            t.stats.deferrals++;
+            continue;
+        }
+
+        t.deferred = 0;
+        t.started = true;
+        t.lastStart = now;
+        t.task.run();
+        uint32_t elapsed = micros() - now;
+        t.stats.runs++;
+        t.stats.totalUs += elapsed;
+        if (elapsed > t.stats.maxUs) t.stats.maxUs = elapsed;
+        if (elapsed > t.task.budgetUs) t.stats.overruns++;
+    }
+}
+
+uint8_t schedulerTaskCount() {
+    return taskCount;
+}
+
+const SchedulerTask& schedulerTask(uint8_t index) {
+    return tasks[index < taskCount ? index : 0].task;
+}
+
+const SchedulerStats& schedulerStats(uint8_t index) {
+    return tasks[index < taskCount ? index : 0].stats;
+}
+
+void schedulerResetStats() {
+    for (uint8_t i = 0; i < taskCount; i++) {
+        memset(&tasks[i].stats, 0, sizeof(SchedulerStats));
+    }
+}
@@ -0,0 +1,35 @@
+#include "scurve.h"
+
+// From rest to `v`: jerk phases around a constant-acceleration phase, or
+// jerk phases only when v is reached before the full acceleration
+static SCurve ramp(float v, float accel, float jerk) {
+    SCurve c;
+    c.peakSpeed = v;
+    c.peakAccel = jerk > 0 ? min(accel, sqrtf(v * jerk)) : accel;
+    c.jerkTime = jerk > 0 ? c.peakAccel / jerk : 0;
+    c.accelTime = c.peakAccel > 0 ? max(v / c.peakAccel - c.jerkTime, 0.0f) : 0;
+    // Symmetric ramp, so the mean speed is v / 2
+    c.rampSteps = v * (2.0f * c.jerkTime + c.accelTime) / 2.0f;
+    return c;
+}
+
+SCurve scurvePlan(float distance, float speed, float accel, float jerk) {
+    SCurve c = {0, 0, 0, 0, 0, 0};
+    if (distance <= 0 || speed <= 0 || accel <= 0) return c;
+
+    c = ramp(speed, accel, jerk);
+    if (2.0f * c.rampSteps > distance) {
+        // Too short to cruise: highest peak whose ramps fit
+        float lo = 0;
+        float hi = speed;
+        for (uint8_t i = 0; i < 24; i++) {
+            float v = (lo + hi) / 2.0f;
+            if (2.0f * ramp(v, accel, jerk).rampSteps > distance) hi = v;
+            else lo = v;
+        }
+        c = ramp(lo, accel, jerk);
+    }
+    if (c.peakSpeed <= 0) return c;
+    c.seconds = 2.0f * (2.0f * c.jerkTime + c.accelTime) + (distance - 2.0f * c.rampSteps) / c.peakSpeed;
+    return c;
+}
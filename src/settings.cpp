@@ -0,0 +1,273 @@
+#include "settings.h"
+#include "crc.h"
+#include "data_flash.h"
+
+// Two flash blocks of append-only records, each with its sequence number
+// first, its version after it and its CRC last. Records go into one block
+// until it is full, then into the other one.
+struct RecordLog {
+    uint32_t offset;
+    uint16_t size;
+    uint16_t version;
+    uint8_t* newest;          // Copy of the newest valid record
+    bool haveNewest;
+    uint8_t block;            // The one taking records
+    uint16_t nextSlot;        // In that block, slotCount() when it is full
+};
+
+static_assert(offsetof(SettingsRecord, version) == 4 && offsetof(ConfigRecord, version) == 4,
+              "Records start with the sequence and the version");
+static_assert(offsetof(SettingsRecord, crc) == sizeof(SettingsRecord) - 2 &&
+              offsetof(ConfigRecord, crc) == sizeof(ConfigRecord) - 2,
+              "Records end with the CRC");
+
+static bool flashReady = false;
+static SettingsRecord newestSettings;
+static ConfigRecord newestConfig;
+static RecordLog settingsLog = {SETTINGS_FLASH_OFFSET, sizeof(SettingsRecord), SETTINGS_VERSION,
+                                (uint8_t*)&newestSettings, false, 0, 0};
+static RecordLog configLog = {CONFIG_FLASH_OFFSET, sizeof(ConfigRecord), CONFIG_VERSION,
+                              (uint8_t*)&newestConfig, false, 0, 0};
+
+static uint16_t slotCount(const RecordLog& log) {
+    return DATA_FLASH_BLOCK_SIZE / log.size;
+}
+
+static uint32_t blockOffset(const RecordLog& log, uint8_t block) {
+    return log.offset + block * DATA_FLASH_BLOCK_SIZE;
+}
+
+static uint32_t slotOffset(const RecordLog& log, uint8_t block, uint16_t slot) {
+    return blockOffset(log, block) + slot * log.size;
+}
+
+static uint32_t recordSequence(const uint8_t* r) {
+    uint32_t sequence;
+    memcpy(&sequence, r, sizeof(sequence));
+    return sequence;
+}
+
+static uint16_t recordVersion(const uint8_t* r) {
+    uint16_t version;
+    memcpy(&version, r + 4, sizeof(version));
+    return version;
+}
+
+static uint16_t storedCrc(const uint8_t* r, uint16_t size) {
+    uint16_t crc;
+    memcpy(&crc, r + size - 2, sizeof(crc));
+    return crc;
+}
+
+static bool recordValid(const RecordLog& log, const uint8_t* r) {
+    return storedCrc(r, log.size) == crc16(r, log.size - 2) && recordVersion(r) == log.version;
+}
+
+static void logScan(RecordLog& log) {
+    // Slots fill in order, the first blank one after the newest record is
+    // where the next record goes
+    uint8_t r[sizeof(ConfigRecord)];
+    uint16_t slots = slotCount(log);
+    log.haveNewest = false;
+    log.block = 0;
+    log.nextSlot = 0;
+    for (uint8_t block = 0; block < SETTINGS_LOG_BLOCKS; block++) {
+        for (uint16_t slot = 0; slot < slots; slot++) {
+            if (dataFlashBlank(slotOffset(log, block, slot), log.size)) continue;
+            dataFlashRead(slotOffset(log, block, slot), r, log.size);
+            if (!recordValid(log, r)) continue;
+            if (!log.haveNewest || (int32_t)(recordSequence(r) - recordSequence(log.newest)) > 0) {
+                memcpy(log.newest, r, log.size);
+                log.haveNewest = true;
+                log.block = block;
+                log.nextSlot = slot + 1;
+            }
+        }
+    }
+}
+
+// Program one slot and read it back
+static bool programVerified(const RecordLog& log, uint8_t block, uint16_t slot, const uint8_t* r) {
+    uint8_t check[sizeof(ConfigRecord)];
+    if (!dataFlashProgram(slotOffset(log, block, slot), r, log.size)) return false;
+    dataFlashRead(slotOffset(log, block, slot), check, log.size);
+    return memcmp(check, r, log.size) == 0;
+}
+
+static bool logSave(RecordLog& log, const uint8_t* record) {
+    if (!flashReady) return false;
+
+    uint8_t r[sizeof(ConfigRecord)];
+    memcpy(r, record, log.size);
+    uint32_t sequence = log.haveNewest ? recordSequence(log.newest) + 1 : 1;
+    memcpy(r, &sequence, sizeof(sequence));
+    memcpy(r + 4, &log.version, sizeof(log.version));
+    uint16_t crc = crc16(r, log.size - 2);
+    memcpy(r + log.size - 2, &crc, sizeof(crc));
+
+    // Past the newest record in its block, skipping slots a cut write left
+    uint16_t slots = slotCount(log);
+    while (log.nextSlot < slots) {
+        uint16_t slot = log.nextSlot++;
+        if (!dataFlashBlank(slotOffset(log, log.block, slot), log.size)) continue;
+        if (!programVerified(log, log.block, slot, r)) continue;
+        memcpy(log.newest, r, log.size);
+        log.haveNewest = true;
+        return true;
+    }
+
+    // Block full: the record goes into the other block, and the full one is
+    // only erased once the record there reads back, so a power cut at any
+    // point leaves a valid record in one of them
+    uint8_t other = 1 - log.block;
+    if (!dataFlashBlank(blockOffset(log, other), DATA_FLASH_BLOCK_SIZE) && !dataFlashErase(blockOffset(log, other))) {
+        return false;
+    }
+    if (!programVerified(log, other, 0, r)) return false;
+    dataFlashErase(blockOffset(log, log.block));
+    log.block = other;
+    log.nextSlot = 1;
+    memcpy(log.newest, r, log.size);
+    log.haveNewest = true;
+    return true;
+}
+
+bool settingsBegin() {
+    flashReady = dataFlashOpen();
+    if (!flashReady) return false;
+    logScan(settingsLog);
+    logScan(configLog);
+    return true;
+}
+
+bool settingsLoad(SettingsRecord& out) {
+    if (!settingsLog.haveNewest) {
+        memset(&out, 0, sizeof(out));
+        return false;
+    }
+    out = newestSettings;
+    return true;
+}
+
+bool settingsSave(const SettingsRecord& record) {
+    return logSave(settingsLog, (const uint8_t*)&record);
+}
+
+bool configLoad(ConfigRecord& out) {
+    if (!configLog.haveNewest) return false;
+    out = newestConfig;
+    return true;
+}
+
+bool configSave(const ConfigRecord& record) {
+    return logSave(configLog, (const uint8_t*)&record);
+}
+
+enum FieldType {
+    FIELD_INT32,
+    FIELD_FLOAT,
+    FIELD_BYTE,
+    FIELD_FLAG        // A polarity bit
+};
+
+struct ConfigField {
+    const char* name;
+    uint8_t type;
+    uint8_t offset;
+    uint8_t flag;
+    float low;
+    float high;
+};
+
+// Speeds stop at the step engine's limit, half the tick rate
+static const ConfigField FIELDS[] = {
+    {"xsteps", FIELD_INT32, offsetof(ConfigRecord, stepsPerInch[0]), 0, 1, 10000},
+    {"ysteps", FIELD_INT32, offsetof(ConfigRecord, stepsPerInch[1]), 0, 1, 10000},
+    {"xspeed", FIELD_INT32, offsetof(ConfigRecord, speed[0]), 0, 1, 20000},
+    {"yspeed", FIELD_INT32, offsetof(ConfigRecord, speed[1]), 0, 1, 20000},
+    {"rspeed", FIELD_INT32, offsetof(ConfigRecord, speed[2]), 0, 1, 20000},
+    {"xaccel", FIELD_INT32, offsetof(ConfigRecord, accel[0]), 0, 1, 1000000},
+    {"yaccel", FIELD_INT32, offsetof(ConfigRecord, accel[1]), 0, 1, 1000000},
+    {"raccel", FIELD_INT32, offsetof(ConfigRecord, accel[2]), 0, 1, 1000000},
+    {"xrapid", FIELD_INT32, offsetof(ConfigRecord, rapidSpeed[0]), 0, 1, 20000},
+    {"yrapid", FIELD_INT32, offsetof(ConfigRecord, rapidSpeed[1]), 0, 1, 20000},
+    {"xrapidaccel", FIELD_INT32, offsetof(ConfigRecord, rapidAccel[0]), 0, 1, 1000000},
+    {"yrapidaccel", FIELD_INT32, offsetof(ConfigRecord, rapidAccel[1]), 0, 1, 1000000},
+    {"rjerk", FIELD_INT32, offsetof(ConfigRecord, rotationJerk), 0, 0, 10000000},
+    {"xinvert", FIELD_FLAG, offsetof(ConfigRecord, polarity), CONFIG_INVERT_X, 0, 1},
+    {"yinvert", FIELD_FLAG, offsetof(ConfigRecord, polarity), CONFIG_INVERT_Y, 0, 1},
+    {"rinvert", FIELD_FLAG, offsetof(ConfigRecord, polarity), CONFIG_INVERT_R, 0, 1},
+    {"relaylow", FIELD_FLAG, offsetof(ConfigRecord, polarity), CONFIG_RELAY_ACTIVE_LOW, 0, 1},
+    {"width", FIELD_FLOAT, offsetof(ConfigRecord, canvas[0]), 0, 0.1, 200},
+    {"height", FIELD_FLOAT, offsetof(ConfigRecord, canvas[1]), 0, 0.1, 200},
+    {"so12", FIELD_FLOAT, offsetof(ConfigRecord, canvas[2]), 0, 0, 100},
+    {"so34", FIELD_FLOAT, offsetof(ConfigRecord, canvas[3]), 0, 0, 100},
+    {"offset", FIELD_FLOAT, offsetof(ConfigRecord, canvas[4]), 0, 0, 50},
+    {"overtravel", FIELD_FLOAT, offsetof(ConfigRecord, canvas[5]), 0, 0, 50},
+    {"rows12", FIELD_BYTE, offsetof(ConfigRecord, rows[0]), 0, 0, 255},
+    {"rows34", FIELD_BYTE, offsetof(ConfigRecord, rows[1]), 0, 0, 255},
+};
+
+static const uint8_t FIELD_COUNT = sizeof(FIELDS) / sizeof(FIELDS[0]);
+
+uint8_t configFieldCount() {
+    return FIELD_COUNT;
+}
+
+const char* configFieldName(uint8_t field) {
+    return field < FIELD_COUNT ? FIELDS[field].name : "";
+}
+
+float configFieldValue(const ConfigRecord& record, uint8_t field) {
+    if (field >= FIELD_COUNT) return 0;
+    const ConfigField& f = FIELDS[field];
+    const uint8_t* p = (const uint8_t*)&record + f.offset;
+    switch (f.type) {
+        case FIELD_INT32: {
+            int32_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        case FIELD_FLOAT: {
+            float v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        case FIELD_BYTE:
+            return *p;
+        default:
+            return (*p & f.flag) ? 1 : 0;
+    }
+}
+
+int configFieldFind(const char* name) {
+    for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+        if (strcasecmp(name, FIELDS[i].name) == 0) return i;
+    }
+    return -1;
+}
+
+bool configFieldSet(ConfigRecord& record, uint8_t field, float value) {
+    if (field >= FIELD_COUNT) return false;
+    const ConfigField& f = FIELDS[field];
+    if (!(value >= f.low && value <= f.high)) return false;
+    uint8_t* p = (uint8_t*)&record + f.offset;
+    switch (f.type) {
+        case FIELD_INT32: {
+            int32_t v = lroundf(value);
+            memcpy(p, &v, sizeof(v));
+            break;
+        }
+        case FIELD_FLOAT:
+            memcpy(p, &value, sizeof(value));
+            break;
+        case FIELD_BYTE:
+            *p = (uint8_t)lroundf(value);
+            break;
+        default:
+            if (value >= 0.5f) *p |= f.flag;
+            else *p &= ~f.flag;
+            break;
+    }
+    return true;
+}
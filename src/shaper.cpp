@@ -0,0 +1,68 @@
+#include "shaper.h"
+
+Shaper shaperMake(ShaperType type, float frequency, float damping) {
+    Shaper s = {1, {1, 0, 0}, {0, 0, 0}};
+    if (type == SHAPER_OFF || frequency <= 0) return s;
+
+    damping = constrain(damping, 0.0f, SHAPER_MAX_DAMPING);
+    float root = sqrtf(1.0f - damping * damping);
+    float k = expf(-damping * PI / root);
+    float half = 0.5f / (frequency * root);   // Half the damped period
+    if (type == SHAPER_ZV) {
+        s = {2, {1 / (1 + k), k / (1 + k), 0}, {0, half, 0}};
+    } else {
+        float d = (1 + k) * (1 + k);
+        s = {3, {1 / d, 2 * k / d, k * k / d}, {0, half, 2 * half}};
+    }
+    return s;
+}
+
+float shaperDuration(const Shaper& shaper) {
+    return shaper.impulses > 1 ? shaper.delay[shaper.impulses - 1] : 0;
+}
+
+bool shaperActive(const Shaper& shaper) {
+    return shaper.impulses > 1;
+}
+
+ShapedMove shaperPlan(const Shaper& shaper, float distance, float speed, float accel) {
+    ShapedMove m = {0, 0, {0}, {0}, 0};
+    if (distance <= 0 || speed <= 0 || accel <= 0) return m;
+
+    // Cruise for at least the shaper's duration: v^2 / a + v T <= distance
+    float duration = shaperDuration(shaper);
+    float fits = accel * (sqrtf(duration * duration + 4.0f * distance / accel) - duration) / 2.0f;
+    m.peakSpeed = min(speed, fits);
+    float rampTime = m.peakSpeed / accel;
+
+    // Every impulse starts a copy of the ramp; between the edges the
+    // acceleration is the sum of the copies running
+    float edges[2 * SHAPER_MAX_IMPULSES];
+    uint8_t n = 0;
+    uint8_t impulses = max(shaper.impulses, (uint8_t)1);
+    for (uint8_t i = 0; i < impulses; i++) {
+        edges[n++] = shaper.delay[i];
+        edges[n++] = shaper.delay[i] + rampTime;
+    }
+    for (uint8_t i = 1; i < n; i++) {
+        for (uint8_t j = i; j > 0 && edges[j] < edges[j - 1]; j--) {
+            float t = edges[j];
+            edges[j] = edges[j - 1];
+            edges[j - 1] = t;
+        }
+    }
+    for (uint8_t e = 0; e + 1 < n; e++) {
+        float length = edges[e + 1] - edges[e];
+        if (length <= 1e-6f) continue;
+        float mid = (edges[e] + edges[e + 1]) / 2.0f;
+        float share = 0;
+        for (uint8_t i = 0; i < impulses; i++) {
+            if (mid >= shaper.delay[i] && mid < shaper.delay[i] + rampTime) share += shaper.amplitude[i];
+        }
+        m.accel[m.phases] = accel * share;
+        m.seconds[m.phases] = length;
+        m.phases++;
+    }
+    m.totalSeconds = rampTime + distance / m.peakSpeed + duration;
+    return m;
+}
@@ -0,0 +1,129 @@
+#include "side_order.h"
+#include "config.h"
+#include "rotary.h"
+
+struct Placement {
+    uint8_t side;
+    bool reverseX;
+    bool reverseY;
+};
+
+static Placement order[RASTER_SIDES];
+static uint8_t orderCount = 0;
+static float drySeconds = 0;
+static long endAngle = 0;         // Tray position after the last side
+
+// Search state
+static const AxisMotion (*searchMotion)[PLAN_AXIS_COUNT];
+static bool used[RASTER_SIDES];
+static Placement trial[RASTER_SIDES];
+static uint8_t wanted = 0;
+static float bestSeconds;
+
+// Racetrack rows start with a dry X move out into the overtravel
+static long overtravelMove(uint8_t side, bool reverseX) {
+    const RasterSide& s = rasterSide(side);
+    if (s.overtravelEnd <= 0) return 0;
+    return reverseX ? s.overtravelEnd : s.overtravelStart;
+}
+
+static float moveSeconds(uint8_t side, uint8_t axis, long steps) {
+    return estimatorMoveSeconds(steps, searchMotion[side][axis]);
+}
+
+static void search(uint8_t depth, RasterPoint at, long angle, float seconds) {
+    if (seconds >= bestSeconds) return;
+
+    if (depth == wanted) {
+        // Back home after the last side
+        uint8_t last = trial[depth - 1].side;
+        seconds += moveSeconds(last, PLAN_AXIS_X, at.x) + moveSeconds(last, PLAN_AXIS_Y, at.y);
+        if (seconds < bestSeconds) {
+            bestSeconds = seconds;
+            for (uint8_t i = 0; i < wanted; i++) order[i] = trial[i];
+        }
+        return;
+    }
+
+    for (uint8_t side = 0; side < RASTER_SIDES; side++) {
+        if (used[side]) continue;
+        used[side] = true;
+        const RasterSide& s = rasterSide(side);
+        long rotation = rotaryShortest(angle, s.trayAngle);
+        float turn = moveSeconds(side, PLAN_AXIS_R, rotation);
+
+        // The original row directions first, so they win ties
+        bool baseReverseY = s.stepOverSteps < 0;
+        for (uint8_t corner = 0; corner < 4; corner++) {
+            bool reverseX = corner & 1;
+            bool reverseY = ((corner >> 1) & 1) != baseReverseY;
+            RasterPoint entry = rasterEntry(side, reverseX, reverseY);
+            float t = turn + moveSeconds(side, PLAN_AXIS_X, entry.x - at.x) +
+                      moveSeconds(side, PLAN_AXIS_Y, entry.y - at.y) +
+                      moveSeconds(side, PLAN_AXIS_X, overtravelMove(side, reverseX));
+            trial[depth] = {side, reverseX, reverseY};
+            search(depth + 1, rasterExit(side, reverseX, reverseY), angle + rotation, seconds + t);
+        }
+        used[side] = false;
+    }
+}
+
+void sideOrderPlan(const bool selected[RASTER_SIDES], const AxisMotion motion[RASTER_SIDES][PLAN_AXIS_COUNT],
+                   uint8_t startQuarter) {
+    searchMotion = motion;
+    wanted = 0;
+    for (uint8_t side = 0; side < RASTER_SIDES; side++) {
+        used[side] = !selected[side];
+        if (selected[side]) wanted++;
+        rasterPlace(side, 0, 0, 0, 0, 0);
+    }
+    orderCount = wanted;
+    drySeconds = 0;
+    long startAngle = rotaryQuarter(startQuarter);
+    endAngle = startAngle;
+    if (!wanted) return;
+
+    bestSeconds = 1e30f;
+    search(0, {0, 0}, startAngle, 0);
+    drySeconds = bestSeconds;
+
+    // Write the plan into the sides
+    RasterPoint at = {0, 0};
+    long angle = startAngle;
+    for (uint8_t i = 0; i < orderCount; i++) {
+        const Placement& p = order[i];
+        rasterOrient(p.side, p.reverseX, p.reverseY);
+        RasterPoint entry = rasterEntry(p.side, p.reverseX, p.reverseY);
+        long rotation = rotaryShortest(angle, rasterSide(p.side).trayAngle);
+        rasterPlace(p.side, rotation, entry.x - at.x, entry.y - at.y, 0, 0);
+        angle += rotation;
+        at = rasterExit(p.side, p.reverseX, p.reverseY);
+    }
+    endAngle = angle;
+    const Placement& last = order[orderCount - 1];
+    const RasterSide& s = rasterSide(last.side);
+    rasterPlace(last.side, s.rotationSteps, s.leadInX, s.leadInY, -at.x, -at.y);
+}
+
+uint8_t sideOrderCount() {
+    return orderCount;
+}
+
+uint8_t sideOrderSide(uint8_t step) {
+    return order[step < orderCount ? step : 0].side;
+}
+
+int sideOrderStep(uint8_t side) {
+    for (uint8_t i = 0; i < orderCount; i++) {
+        if (order[i].side == side) return i;
+    }
+    return -1;
+}
+
+float sideOrderDrySeconds() {
+    return drySeconds;
+}
+
+long sideOrderLoadTurn() {
+    return rotaryShortest(endAngle, 0);
+}
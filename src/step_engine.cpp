@@ -0,0 +1,667 @@
+#include "step_engine.h"
+
+#if defined(ARDUINO_ARCH_RENESAS)
+#include <FspTimer.h>
+#endif
+
+static StepAxis* axes[MAX_STEP_AXES];
+static uint8_t axisCount = 0;
+
+static FastPin sprayPin = {nullptr, 0, 0};
+static bool sprayActiveLow = true;
+static bool sprayAttached = false;
+static volatile bool sprayState = false;    // Requested by segments and the foreground
+static volatile bool sprayOutput = false;    // What the relay is actually driven to
+static volatile bool halted = false;         // Emergency stop, no steps and no spray
+
+// Position gate on the relay (racetrack passes): while active the relay only
+// follows sprayState inside the window. Bounds are pre-shifted by the valve
+// leads for each direction of travel.
+struct SprayWindow {
+    StepAxis* axis;
+    int32_t openForward;
+    int32_t closeForward;
+    int32_t openReverse;
+    int32_t closeReverse;
+};
+
+static SprayWindow window;
+static volatile bool windowActive = false;
+
+// Coordinated line state, only touched by the interrupt while active
+struct LineMove {
+    StepAxis* axis[MAX_STEP_AXES];
+    uint32_t delta[MAX_STEP_AXES];
+    uint32_t error[MAX_STEP_AXES];
+    uint8_t count;
+    uint32_t major;           // Step count of the longest axis, drives the profile
+    uint32_t done;
+    uint32_t rate;
+    uint32_t maxRate;
+    uint32_t accelRate;
+    uint32_t minRate;
+    uint32_t phase;
+    int8_t endSpray;
+    bool settle;              // One tick of direction setup before the first step
+};
+
+static LineMove line;
+static volatile bool lineActive = false;
+static volatile uint32_t linesDone = 0;
+static uint32_t linesStarted = 0;      // Equals linesDone whenever no line runs
+
+static const float Q32 = 4294967296.0f;
+static const uint32_t MAX_RATE = 0x7FFFFFFF;   // 0.5 steps per tick, one tick high and one low
+static const uint32_t MIN_RATE_TICKS = 64;     // Crawl rate = speed reached after this many ticks
+
+static StepTimingStats timing;
+static uint32_t lastTickStart = 0;
+
+static void pinInit(FastPin& p);
+static void pinWrite(const FastPin& p, bool high);
+static uint32_t cycleCount();
+
+static uint32_t rateFromSpeed(float stepsPerSecond) {
+    float r = fabsf(stepsPerSecond) / STEP_TICK_HZ * Q32;
+    if (r >= (float)MAX_RATE) return MAX_RATE;
+    return (uint32_t)r;
+}
+
+static uint32_t rateFromAccel(float stepsPerSecond2) {
+    float r = fabsf(stepsPerSecond2) / ((float)STEP_TICK_HZ * STEP_TICK_HZ) * Q32;
+    if (r < 1.0f) return 1;
+    return (uint32_t)r;
+}
+
+static bool insideWindow() {
+    int32_t pos = window.axis->currentPosition();
+    if (window.axis->movingForward()) {
+        return pos >= window.openForward && pos < window.closeForward;
+    }
+    return pos <= window.openReverse && pos > window.closeReverse;
+}
+
+static void driveRelay() {
+    bool on = sprayState && !halted && (!windowActive || insideWindow());
+    if (on == sprayOutput) return;
+    sprayOutput = on;
+    if (sprayAttached) pinWrite(sprayPin, on != sprayActiveLow);
+}
+
+static void applySpray(int8_t action) {
+    if (action == SPRAY_KEEP) return;
+    sprayState = action == SPRAY_SET_ON;
+    driveRelay();
+}
+
+StepAxis::StepAxis(uint8_t step, uint8_t dir)
+    : dirInverted(false), stepInverted(false),
+      position(0), target(0), rate(0), maxRate(1), exitRate(0), accelRate(1), minRate(1),
+      endSpray(SPRAY_KEEP), endLead(0), segmentActive(false), segmentsDone(0), queueHead(0), queueCount(0),
+      baseMaxRate(1), baseAccelRate(1), phase(0), forward(true), pulseHigh(false), pinsReady(false) {
+    stepPin.pin = step;
+    dirPin.pin = dir;
+    stepPin.reg = dirPin.reg = nullptr;
+    if (axisCount < MAX_STEP_AXES) {
+        axes[axisCount++] = this;
+    }
+}
+
+void StepAxis::setMaxSpeed(float speed) {
+    uint32_t r = rateFromSpeed(speed);
+    if (r == 0) r = 1;
+    noInterrupts();
+    baseMaxRate = r;
+    if (!segmentActive) maxRate = r;
+    minRate = min(accelRate * MIN_RATE_TICKS, baseMaxRate);
+    interrupts();
+}
+
+void StepAxis::setAcceleration(float accel) {
+    uint32_t a = rateFromAccel(accel);
+    noInterrupts();
+    baseAccelRate = a;
+    if (!segmentActive) accelRate = a;
+    minRate = min(accelRate * MIN_RATE_TICKS, baseMaxRate);
+    interrupts();
+}
+
+void StepAxis::setPinsInverted(bool directionInvert, bool stepInvert) {
+    dirInverted = directionInvert;
+    stepInverted = stepInvert;
+    if (pinsReady) {
+        pinWrite(stepPin, stepInverted);
+        pinWrite(dirPin, forward != dirInverted);
+    }
+}
+
+void StepAxis::clearQueue() {
+    queueCount = 0;
+    segmentActive = false;
+    endSpray = SPRAY_KEEP;
+    exitRate = 0;
+    maxRate = baseMaxRate;
+}
+
+void StepAxis::moveTo(long absolute) {
+    noInterrupts();
+    clearQueue();
+    target = absolute;
+    interrupts();
+}
+
+void StepAxis::move(long relative) {
+    moveTo(position + relative);
+}
+
+void StepAxis::stop() {
+    noInterrupts();
+    clearQueue();
+    if (rate != 0) {
+        // Shortest stop at the configured acceleration: d = v^2 / 2a
+        uint32_t v = rate >> 16;
+        int32_t brake = (int32_t)(((uint64_t)v * v) / (2ULL * accelRate)) + 1;
+        target = forward ? position + brake : position - brake;
+    } else {
+        target = position;
+    }
+    interrupts();
+}
+
+void StepAxis::setCurrentPosition(long pos) {
+    noInterrupts();
+    clearQueue();
+    position = pos;
+    target = pos;
+    rate = 0;
+    phase = 0;
+    interrupts();
+}
+
+bool StepAxis::queueSegment(long segmentTarget, float segmentMaxSpeed, float exitSpeed,
+                            int8_t startSpray, int8_t segmentEndSpray, long endLeadSteps, float accel) {
+    Segment s;
+    s.target = segmentTarget;
+    s.maxRate = rateFromSpeed(segmentMaxSpeed);
+    if (s.maxRate == 0) s.maxRate = 1;
+    s.exitRate = min(rateFromSpeed(exitSpeed), s.maxRate);
+    s.accelRate = accel > 0 ? rateFromAccel(accel) : 0;
+    s.startSpray = startSpray;
+    s.endSpray = segmentEndSpray;
+    s.endLead = endLeadSteps > 0 ? endLeadSteps : 0;
+
+    noInterrupts();
+    if (queueCount >= SEGMENT_QUEUE_SIZE) {
+        interrupts();
+        return false;
+    }
+    queue[(queueHead + queueCount) % SEGMENT_QUEUE_SIZE] = s;
+    queueCount++;
+    if (!segmentActive && target == position) {
+        // Axis is idle at its target, start right away
+        loadNextSegment();
+    }
+    interrupts();
+    return true;
+}
+
+bool StepAxis::queueFull() const {
+    return queueCount >= SEGMENT_QUEUE_SIZE;
+}
+
+uint32_t StepAxis::completedSegments() const {
+    return segmentsDone;
+}
+
+bool StepAxis::loadNextSegment() {
+    if (queueCount == 0) return false;
+    const Segment& s = queue[queueHead];
+    queueHead = (queueHead + 1) % SEGMENT_QUEUE_SIZE;
+    queueCount--;
+    target = s.target;
+    maxRate = s.maxRate;
+    exitRate = s.exitRate;
+    accelRate = s.accelRate ? s.accelRate : baseAccelRate;
+    minRate = min(accelRate * MIN_RATE_TICKS, baseMaxRate);
+    endSpray = s.endSpray;
+    endLead = s.endLead;
+    segmentActive = true;
+    applySpray(s.startSpray);
+    return true;
+}
+
+long StepAxis::currentPosition() const {
+    return position;
+}
+
+long StepAxis::targetPosition() const {
+    return target;
+}
+
+long StepAxis::distanceToGo() const {
+    return target - position;
+}
+
+float StepAxis::speed() const {
+    float s = rate / Q32 * STEP_TICK_HZ;
+    return forward ? s : -s;
+}
+
+float StepAxis::acceleration() const {
+    return accelRate / Q32 * ((float)STEP_TICK_HZ * STEP_TICK_HZ);
+}
+
+float StepAxis::maxSpeed() const {
+    return baseMaxRate / Q32 * STEP_TICK_HZ;
+}
+
+bool StepAxis::isRunning() const {
+    return rate != 0 || target != position || queueCount != 0;
+}
+
+bool StepAxis::movingForward() const {
+    return forward;
+}
+
+void StepAxis::begin() {
+    pinMode(stepPin.pin, OUTPUT);
+    pinMode(dirPin.pin, OUTPUT);
+    pinInit(stepPin);
+    pinInit(dirPin);
+    pinWrite(stepPin, stepInverted);
+    pinWrite(dirPin, forward != dirInverted);
+    pinsReady = true;
+}
+
+void StepAxis::tick() {
+    if (pulseHigh) {
+        pinWrite(stepPin, stepInverted);
+        pulseHigh = false;
+    }
+
+    int32_t remaining = target - position;
+    while (remaining == 0) {
+        if (segmentActive) {
+            segmentActive = false;
+            segmentsDone++;
+            applySpray(endSpray);
+            endSpray = SPRAY_KEEP;
+        }
+        if (!loadNextSegment()) {
+            maxRate = baseMaxRate;
+            accelRate = baseAccelRate;
+            minRate = min(accelRate * MIN_RATE_TICKS, baseMaxRate);
+            exitRate = 0;
+            rate = 0;
+            phase = 0;
+            return;
+        }
+        remaining = target - position;
+    }
+
+    if ((remaining > 0) != forward) {
+        // Moving away from the target (or standing still facing the wrong way):
+        // decelerate, then flip direction and give the driver a tick of setup time
+        if (rate > accelRate) {
+            rate -= accelRate;
+        } else {
+            rate = 0;
+            phase = 0;
+            forward = !forward;
+            pinWrite(dirPin, forward != dirInverted);
+            return;
+        }
+    } else {
+        // Brake when v^2 - ve^2 reaches 2 * a * remaining. The exit rate only
+        // counts while a segment is queued to take it over.
+        uint32_t distance = remaining > 0 ? remaining : -remaining;
+        if (endSpray != SPRAY_KEEP && distance <= endLead) {
+            // Relay lead/lag: switch ahead of the segment end
+            applySpray(endSpray);
+            endSpray = SPRAY_KEEP;
+        }
+        uint32_t handover = queueCount ? exitRate : 0;
+        uint32_t v = rate >> 16;
+        uint32_t ve = handover >> 16;
+        uint32_t floor = max(minRate, handover);
+        if ((uint64_t)v * v >= (uint64_t)ve * ve + (uint64_t)(2 * accelRate) * distance) {
+            rate = rate > floor + accelRate ? rate - accelRate : floor;
+        } else if (rate < maxRate) {
+            rate = maxRate - rate > accelRate ? rate + accelRate : maxRate;
+        } else if (rate > maxRate) {
+            rate = rate - maxRate > accelRate ? rate - accelRate : maxRate;
+        }
+        if (rate < minRate) rate = minRate;
+    }
+
+    uint32_t previous = phase;
+    phase += rate;
+    if (phase < previous) {
+        position += forward ? 1 : -1;
+        pinWrite(stepPin, !stepInverted);
+        pulseHigh = true;
+    }
+}
+
+bool StepAxis::setDirection(bool dir) {
+    if (dir == forward) return false;
+    forward = dir;
+    pinWrite(dirPin, forward != dirInverted);
+    return true;
+}
+
+void StepAxis::halt() {
+    clearQueue();
+    target = position;
+    rate = 0;
+    phase = 0;
+    if (pulseHigh) {
+        pinWrite(stepPin, stepInverted);
+        pulseHigh = false;
+    }
+}
+
+void StepAxis::pulseStep() {
+    // Target follows so tick() sees the axis as idle
+    int32_t step = forward ? 1 : -1;
+    position += step;
+    target += step;
+    pinWrite(stepPin, !stepInverted);
+    pulseHigh = true;
+}
+
+static void lineTick() {
+    if (line.settle) {
+        line.settle = false;
+        return;
+    }
+
+    uint32_t remaining = line.major - line.done;
+    if (remaining == 0) {
+        lineActive = false;
+        linesDone++;
+        applySpray(line.endSpray);
+        return;
+    }
+
+    uint32_t v = line.rate >> 16;
+    if ((uint64_t)v * v >= (uint64_t)(2 * line.accelRate) * remaining) {
+        line.rate = line.rate > line.minRate + line.accelRate ? line.rate - line.accelRate : line.minRate;
+    } else if (line.rate < line.maxRate) {
+        line.rate = line.maxRate - line.rate > line.accelRate ? line.rate + line.accelRate : line.maxRate;
+    }
+    if (line.rate < line.minRate) line.rate = line.minRate;
+
+    uint32_t previous = line.phase;
+    line.phase += line.rate;
+    if (line.phase >= previous) return;
+
+    // One step on the major axis, Bresenham the rest
+    line.done++;
+    for (uint8_t i = 0; i < line.count; i++) {
+        line.error[i] += line.delta[i];
+        if (line.error[i] >= line.major) {
+            line.error[i] -= line.major;
+            line.axis[i]->pulseStep();
+        }
+    }
+}
+
+void stepEngineTick() {
+    uint32_t start = cycleCount();
+    bool late = false;
+    if (timing.periodCycles && timing.ticks) {
+        uint32_t interval = start - lastTickStart;
+        uint32_t jitter = interval > timing.periodCycles ? interval - timing.periodCycles
+                                                         : timing.periodCycles - interval;
+        if (jitter > timing.maxJitterCycles) timing.maxJitterCycles = jitter;
+        late = interval > timing.periodCycles + timing.periodCycles / 2;
+        if (late) timing.lateTicks++;
+    }
+    lastTickStart = start;
+    timing.ticks++;
+    if (halted) return;
+
+    int32_t before[MAX_STEP_AXES];
+    if (late) {
+        for (uint8_t i = 0; i < axisCount; i++) before[i] = axes[i]->currentPosition();
+    }
+
+    for (uint8_t i = 0; i < axisCount; i++) {
+        axes[i]->tick();
+    }
+    if (lineActive) {
+        lineTick();
+    }
+    if (windowActive) {
+        driveRelay();
+    }
+
+    if (late) {
+        for (uint8_t i = 0; i < axisCount; i++) {
+            if (axes[i]->currentPosition() != before[i]) timing.lateSteps[i]++;
+        }
+    }
+    uint32_t busy = cycleCount() - start;
+    if (busy > timing.maxTickCycles) timing.maxTickCycles = busy;
+}
+
+void stepEngineTimingStats(StepTimingStats& out) {
+    noInterrupts();
+    out = timing;
+    interrupts();
+}
+
+void stepEngineResetTiming() {
+    noInterrupts();
+    uint32_t period = timing.periodCycles;
+    timing = StepTimingStats();
+    timing.periodCycles = period;
+    interrupts();
+}
+
+bool stepEngineLine(StepAxis* const lineAxes[], const long steps[], uint8_t count,
+                    float maxSpeed, float accel, int8_t startSpray, int8_t endSpray) {
+    if (lineActive || count > MAX_STEP_AXES) return false;
+    for (uint8_t i = 0; i < count; i++) {
+        if (lineAxes[i]->isRunning()) return false;
+    }
+
+    noInterrupts();
+    line.count = count;
+    line.major = 0;
+    line.settle = false;
+    for (uint8_t i = 0; i < count; i++) {
+        line.axis[i] = lineAxes[i];
+        line.delta[i] = steps[i] >= 0 ? steps[i] : -steps[i];
+        if (line.delta[i] > line.major) line.major = line.delta[i];
+        if (line.delta[i] && lineAxes[i]->setDirection(steps[i] > 0)) line.settle = true;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        line.error[i] = line.major / 2;
+    }
+    line.done = 0;
+    line.rate = 0;
+    line.phase = 0;
+    line.maxRate = max(rateFromSpeed(maxSpeed), (uint32_t)1);
+    line.accelRate = rateFromAccel(accel);
+    line.minRate = min(line.accelRate * MIN_RATE_TICKS, line.maxRate);
+    line.endSpray = endSpray;
+    applySpray(startSpray);
+    linesStarted++;
+    lineActive = line.major > 0;
+    if (!lineActive) {
+        linesDone++;
+        applySpray(endSpray);
+    }
+    interrupts();
+    return true;
+}
+
+void stepEngineStopLine() {
+    noInterrupts();
+    if (lineActive) {
+        uint32_t v = line.rate >> 16;
+        uint32_t brake = (uint32_t)(((uint64_t)v * v) / (2ULL * line.accelRate)) + 1;
+        uint32_t stopAt = line.done + brake;
+        if (stopAt < line.major) line.major = stopAt;
+        line.endSpray = SPRAY_KEEP;
+    }
+    interrupts();
+}
+
+bool stepEngineLineActive() {
+    return lineActive;
+}
+
+uint32_t stepEngineLinesCompleted() {
+    return linesDone;
+}
+
+uint32_t stepEngineLinesStarted() {
+    return linesStarted;
+}
+
+void stepEngineHalt(long positions[MAX_STEP_AXES]) {
+    noInterrupts();
+    halted = true;
+    sprayState = false;
+    driveRelay();
+    if (lineActive) linesDone++;       // Dropped, counted so the counters still agree
+    lineActive = false;
+    for (uint8_t i = 0; i < MAX_STEP_AXES; i++) {
+        if (i < axisCount) axes[i]->halt();
+        positions[i] = i < axisCount ? axes[i]->currentPosition() : 0;
+    }
+    interrupts();
+}
+
+void stepEngineRelease() {
+    halted = false;
+}
+
+bool stepEngineHalted() {
+    return halted;
+}
+
+void stepEngineAttachSpray(uint8_t pin, bool activeLow) {
+    sprayPin.pin = pin;
+    sprayActiveLow = activeLow;
+    pinMode(pin, OUTPUT);
+    pinInit(sprayPin);
+    sprayAttached = true;
+    pinWrite(sprayPin, sprayOutput != sprayActiveLow);
+}
+
+void stepEngineSetSpray(bool on) {
+    noInterrupts();
+    applySpray(on ? SPRAY_SET_ON : SPRAY_SET_OFF);
+    interrupts();
+}
+
+bool stepEngineSprayOn() {
+    return sprayState;
+}
+
+bool stepEngineRelayOpen() {
+    return sprayOutput;
+}
+
+void stepEngineSetSprayWindow(StepAxis* axis, long from, long to, long openLeadSteps, long closeLeadSteps) {
+    if (from > to) {
+        long t = from;
+        from = to;
+        to = t;
+    }
+    noInterrupts();
+    window.axis = axis;
+    window.openForward = from - openLeadSteps;
+    window.closeForward = to - closeLeadSteps;
+    window.openReverse = to + openLeadSteps;
+    window.closeReverse = from + closeLeadSteps;
+    windowActive = axis != nullptr;
+    driveRelay();
+    interrupts();
+}
+
+void stepEngineClearSprayWindow() {
+    noInterrupts();
+    windowActive = false;
+    driveRelay();
+    interrupts();
+}
+
+#if defined(ARDUINO_ARCH_RENESAS)
+
+// Direct port writes through PCNTR3 (set bits low half, reset bits high half),
+// digitalWrite() is too slow to call for every axis at STEP_TICK_HZ
+static void pinInit(FastPin& p) {
+    bsp_io_port_pin_t bspPin = g_pin_cfg[p.pin].pin;
+    uint32_t portStride = (uint32_t)R_PORT1 - (uint32_t)R_PORT0;
+    R_PORT0_Type* port = (R_PORT0_Type*)((uint32_t)R_PORT0 + ((uint32_t)bspPin >> 8) * portStride);
+    p.reg = &port->PCNTR3;
+    p.mask = 1u << ((uint32_t)bspPin & 0xFF);
+}
+
+static void pinWrite(const FastPin& p, bool high) {
+    *p.reg = high ? p.mask : ((uint32_t)p.mask << 16);
+}
+
+static uint32_t cycleCount() {
+    return DWT->CYCCNT;
+}
+
+static FspTimer stepTimer;
+
+static void stepTimerCallback(timer_callback_args_t*) {
+    stepEngineTick();
+}
+
+bool stepEngineBegin() {
+    for (uint8_t i = 0; i < axisCount; i++) {
+        axes[i]->begin();
+    }
+
+    // Cortex-M4 cycle counter for the timing stats
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    timing.periodCycles = SystemCoreClock / STEP_TICK_HZ;
+
+    uint8_t type = GPT_TIMER;
+    int8_t channel = FspTimer::get_available_timer(type);
+    if (channel < 0 || type != GPT_TIMER) {
+        return false;
+    }
+    if (!stepTimer.begin(TIMER_MODE_PERIODIC, type, channel, (float)STEP_TICK_HZ, 0.0f, stepTimerCallback)) {
+        return false;
+    }
+    if (!stepTimer.setup_overflow_irq(STEP_IRQ_PRIORITY)) {
+        return false;
+    }
+    return stepTimer.open() && stepTimer.start();
+}
+
+#else
+
+// Host builds: plain digitalWrite, and the caller drives stepEngineTick()
+static void pinInit(FastPin& p) {
+    p.reg = nullptr;
+    p.mask = 0;
+}
+
+static void pinWrite(const FastPin& p, bool high) {
+    digitalWrite(p.pin, high ? HIGH : LOW);
+}
+
+static uint32_t cycleCount() {
+    return 0;
+}
+
+bool stepEngineBegin() {
+    for (uint8_t i = 0; i < axisCount; i++) {
+        axes[i]->begin();
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,385 @@
+#include "telemetry.h"
+
+#if defined(ARDUINO_UNOR4_WIFI)
+#include <WiFiS3.h>
+#endif
+
+// Credentials from the build (-DTELEMETRY_SSID=\"booth\"), or set with W
+#ifndef TELEMETRY_SSID
+#define TELEMETRY_SSID ""
+#endif
+#ifndef TELEMETRY_PASSWORD
+#define TELEMETRY_PASSWORD ""
+#endif
+#ifndef TELEMETRY_TOKEN
+#define TELEMETRY_TOKEN ""
+#endif
+
+static TelemetryCommand commandHandler = nullptr;
+static TelemetryStatusFill statusHandler = nullptr;
+static char ssid[33] = TELEMETRY_SSID;
+static char password[64] = TELEMETRY_PASSWORD;
+static char token[TELEMETRY_TOKEN_LENGTH + 1] = TELEMETRY_TOKEN;
+
+static TelemetryJob jobs[TELEMETRY_LOG_SIZE];
+static uint8_t jobHead = 0;         // Next slot to write
+static uint8_t jobCount = 0;
+
+static void networkRestart();
+
+// Bounded text output, drops what does not fit
+struct Writer {
+    char* out;
+    uint16_t size;
+    uint16_t length;
+
+    void text(const char* s) {
+        while (*s && length + 1 < size) out[length++] = *s++;
+        out[length] = 0;
+    }
+
+    void number(long value) {
+        char digits[12];
+        ltoa(value, digits, 10);
+        text(digits);
+    }
+
+    void tenths(float value) {
+        long t = lroundf(value * 10.0f);
+        if (t < 0) {
+            text("-");
+            t = -t;
+        }
+        number(t / 10);
+        text(".");
+        number(t % 10);
+    }
+
+    void quoted(const char* s) {
+        text("\"");
+        for (; *s; s++) {
+            // Labels come from the operator, keep the JSON valid
+            if (*s == '"' || *s == '\\' || (uint8_t)*s < 0x20) continue;
+            char c[2] = {*s, 0};
+            text(c);
+        }
+        text("\"");
+    }
+
+    void field(const char* name) {
+        if (out[length - 1] != '{') text(",");
+        quoted(name);
+        text(":");
+    }
+};
+
+static void writeStatus(Writer& w) {
+    TelemetryStatus s = {"UNKNOWN", 0, 0, {0, 0, 0}, false, 0, ""};
+    if (statusHandler) statusHandler(s);
+    w.text("{");
+    w.field("state");
+    w.quoted(s.state);
+    w.field("side");
+    w.number(s.side);
+    w.field("command");
+    w.number(s.command);
+    w.field("x");
+    w.number(s.position[0]);
+    w.field("y");
+    w.number(s.position[1]);
+    w.field("r");
+    w.number(s.position[2]);
+    w.field("spray");
+    w.text(s.spray ? "true" : "false");
+    w.field("batch");
+    w.number(s.batchRemaining);
+    w.field("color");
+    w.quoted(s.color);
+    w.field("uptime");
+    w.number(millis() / 1000);
+    w.text("}");
+}
+
+static void writeLog(Writer& w) {
+    w.text("[");
+    for (uint8_t i = 0; i < jobCount; i++) {
+        const TelemetryJob& j = jobs[(jobHead + TELEMETRY_LOG_SIZE - 1 - i) % TELEMETRY_LOG_SIZE];
+        if (i > 0) w.text(",");
+        w.text("{");
+        w.field("finished");
+        w.number(j.finishedAt / 1000);
+        w.field("seconds");
+        w.tenths(j.seconds);
+        w.field("sides");
+        w.text("\"");
+        for (uint8_t side = 0; side < 4; side++) {
+            if (j.sides & (1 << side)) w.number(side + 1);
+        }
+        w.text("\"");
+        w.field("speed");
+        w.number(j.speedPercent);
+        w.field("completed");
+        w.text(j.completed ? "true" : "false");
+        w.field("color");
+        w.quoted(j.color);
+        w.text("}");
+    }
+    w.text("]");
+}
+
+static uint8_t hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 0;
+}
+
+// Value of `name` in the query string, URL-decoded
+// Decoded value of name=, -1 if it does not fit in out
+static int queryValue(const char* query, const char* name, char* out, uint8_t size) {
+    uint8_t nameLength = strlen(name);
+    const char* p = query;
+    while (p && *p) {
+        if (strncmp(p, name, nameLength) == 0 && p[nameLength] == '=') {
+            p += nameLength + 1;
+            uint8_t n = 0;
+            while (*p && *p != '&' && *p != ' ') {
+                if (n + 1 >= size) {
+                    out[0] = 0;
+                    return -1;
+                }
+                if (*p == '%' && p[1] && p[2]) {
+                    out[n++] = (char)(hexValue(p[1]) << 4 | hexValue(p[2]));
+                    p += 3;
+                } else {
+                    out[n++] = *p == '+' ? ' ' : *p;
+                    p++;
+                }
+            }
+            out[n] = 0;
+            return n;
+        }
+        p = strchr(p, '&');
+        if (p) p++;
+    }
+    out[0] = 0;
+    return 0;
+}
+
+// Compares every character, so the time taken says nothing about the token
+static bool tokenMatches(const char* given) {
+    uint8_t length = strlen(token);
+    if (!length || strlen(given) != length) return false;
+    uint8_t diff = 0;
+    for (uint8_t i = 0; i < length; i++) diff |= given[i] ^ token[i];
+    return diff == 0;
+}
+
+static void writeResponse(Writer& w, const char* result, char body) {
+    w.text("HTTP/1.1 ");
+    w.text(result);
+    w.text("\r\nContent-Type: application/json\r\nConnection: close\r\n\r\n");
+    if (body == 's') {
+        writeStatus(w);
+    } else if (body == 'l') {
+        writeLog(w);
+    } else {
+        w.text("{\"error\":");
+        w.quoted(result + 4);
+        w.text("}");
+    }
+    w.text("\n");
+}
+
+uint16_t telemetryHandle(const char* request, char* out, uint16_t size) {
+    Writer w = {out, size, 0};
+    if (size) out[0] = 0;
+
+    bool post = strncmp(request, "POST ", 5) == 0;
+    const char* path = post ? request + 5 : strncmp(request, "GET ", 4) == 0 ? request + 4 : nullptr;
+    const char* query = path ? strchr(path, '?') : nullptr;
+    if (query) query++;
+    const char* result = "200 OK";
+    char body = 0;
+    if (path && !post && strncmp(path, "/status", 7) == 0 && (path[7] == ' ' || path[7] == '?')) {
+        body = 's';
+    } else if (path && !post && strncmp(path, "/log", 4) == 0 && (path[4] == ' ' || path[4] == '?')) {
+        body = 'l';
+    } else if (path && strncmp(path, "/cmd", 4) == 0 && (path[4] == ' ' || path[4] == '?')) {
+        // Commands move the machine: POST only, and only with the token
+        char given[TELEMETRY_TOKEN_LENGTH + 2];
+        queryValue(query, "token", given, sizeof(given));
+        char line[64];
+        int length = queryValue(query, "line", line, sizeof(line));
+        if (!post) {
+            result = "405 Method Not Allowed";
+        } else if (length < 0) {
+            result = "414 URI Too Long";    // Never run a command cut short
+        } else if (!tokenMatches(given)) {
+            result = "403 Forbidden";
+        } else if (length && commandHandler && !commandHandler(line, length)) {
+            result = "409 Conflict";
+        } else {
+            body = 's';
+        }
+    } else {
+        result = "404 Not Found";
+    }
+    writeResponse(w, result, body);
+    return w.length;
+}
+
+void telemetryBegin(TelemetryCommand runLine, TelemetryStatusFill fillStatus) {
+    commandHandler = runLine;
+    statusHandler = fillStatus;
+}
+
+void telemetrySetToken(const char* newToken) {
+    strncpy(token, newToken, sizeof(token) - 1);
+    token[sizeof(token) - 1] = 0;
+}
+
+bool telemetryHasToken() {
+    return token[0] != 0;
+}
+
+void telemetrySetNetwork(const char* newSsid, const char* newPassword) {
+    strncpy(ssid, newSsid, sizeof(ssid) - 1);
+    ssid[sizeof(ssid) - 1] = 0;
+    strncpy(password, newPassword, sizeof(password) - 1);
+    password[sizeof(password) - 1] = 0;
+    networkRestart();
+}
+
+void telemetryLogJob(const TelemetryJob& job) {
+    jobs[jobHead] = job;
+    jobHead = (jobHead + 1) % TELEMETRY_LOG_SIZE;
+    if (jobCount < TELEMETRY_LOG_SIZE) jobCount++;
+}
+
+#if defined(ARDUINO_UNOR4_WIFI)
+
+enum NetPhase {
+    NET_OFF,
+    NET_LISTENING,
+    NET_READING,      // Client connected, collecting the request line
+    NET_RESPONDING,
+    NET_CLOSING
+};
+
+static WiFiServer server(TELEMETRY_PORT);
+static WiFiClient client;
+static NetPhase phase = NET_OFF;
+static unsigned long lastPoll = 0;
+static unsigned long lastAttempt = 0;
+static bool attempted = false;
+static unsigned long clientSince = 0;
+static char request[128];
+static uint8_t requestLength = 0;
+static bool requestTooLong = false;   // Answered 414 and nothing is run
+static char response[TELEMETRY_RESPONSE_SIZE];
+static uint16_t responseLength = 0;
+
+bool telemetryConnected() {
+    return phase != NET_OFF;
+}
+
+static void networkRestart() {
+    if (phase != NET_OFF) {
+        client.stop();
+        WiFi.disconnect();
+    }
+    phase = NET_OFF;
+    attempted = false;
+}
+
+// One modem transaction per call
+void telemetryService(bool idle) {
+    if (!ssid[0]) return;
+    unsigned long now = millis();
+    if (now - lastPoll < (idle ? TELEMETRY_POLL_MS : TELEMETRY_BUSY_POLL_MS)) return;
+    lastPoll = now;
+
+    switch (phase) {
+        case NET_OFF:
+            if (!idle || (attempted && now - lastAttempt < TELEMETRY_RETRY_MS)) break;
+            attempted = true;
+            lastAttempt = now;
+            if (WiFi.begin(ssid, password) == WL_CONNECTED) {
+                server.begin();
+                phase = NET_LISTENING;
+            }
+            break;
+
+        case NET_LISTENING:
+            if (WiFi.status() != WL_CONNECTED) {
+                phase = NET_OFF;
+                break;
+            }
+            client = server.available();
+            if (client) {
+                requestLength = 0;
+                requestTooLong = false;
+                clientSince = now;
+                phase = NET_READING;
+            }
+            break;
+
+        case NET_READING: {
+            if (now - clientSince > TELEMETRY_CLIENT_MS || !client.connected()) {
+                phase = NET_CLOSING;
+                break;
+            }
+            // Only the request line matters, the headers are dropped with the connection
+            uint8_t buffer[64];
+            int n = client.read(buffer, sizeof(buffer));
+            for (int i = 0; i < n; i++) {
+                char c = buffer[i];
+                if (c == '\r' || c == '\n') {
+                    request[requestLength] = 0;
+                    if (requestTooLong) {
+                        Writer w = {response, sizeof(response), 0};
+                        writeResponse(w, "414 URI Too Long", 0);
+                        responseLength = w.length;
+                    } else {
+                        responseLength = telemetryHandle(request, response, sizeof(response));
+                    }
+                    phase = NET_RESPONDING;
+                    break;
+                }
+                if (requestLength + 1 < sizeof(request)) {
+                    request[requestLength++] = c;
+                } else {
+                    requestTooLong = true;
+                }
+            }
+            break;
+        }
+
+        case NET_RESPONDING:
+            client.write((const uint8_t*)response, responseLength);
+            phase = NET_CLOSING;
+            break;
+
+        case NET_CLOSING:
+            client.stop();
+            phase = NET_LISTENING;
+            break;
+    }
+}
+
+#else
+
+// Host builds: no network, telemetryHandle() still works
+static void networkRestart() {
+}
+
+bool telemetryConnected() {
+    return false;
+}
+
+void telemetryService(bool idle) {
+    (void)idle;
+}
+
+#endif
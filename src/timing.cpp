@@ -0,0 +1,124 @@
+#include "timing.h"
+#include "step_engine.h"
+
+struct SectionStats {
+    uint32_t totalUs;
+    uint32_t maxUs;
+    uint32_t calls;
+};
+
+static uint32_t loops = 0;
+static uint32_t loopMinUs = 0;
+static uint32_t loopMaxUs = 0;
+static uint64_t loopTotalUs = 0;
+static uint32_t passStartUs = 0;
+static bool havePrevious = false;
+static SectionStats sections[TIMING_SECTION_COUNT];
+static uint16_t passHistogram[TIMING_MAX_STATES][TIMING_BUCKETS];
+
+static uint8_t bucketFor(uint32_t us) {
+    uint8_t b = 0;
+    uint32_t limit = 16;
+    while (b < TIMING_BUCKETS - 1 && us >= limit) {
+        b++;
+        limit <<= 1;
+    }
+    return b;
+}
+
+void timingLoopStart() {
+    uint32_t now = micros();
+    if (havePrevious) {
+        uint32_t period = now - passStartUs;
+        if (loops == 0 || period < loopMinUs) loopMinUs = period;
+        if (period > loopMaxUs) loopMaxUs = period;
+        loopTotalUs += period;
+        loops++;
+    }
+    passStartUs = now;
+    havePrevious = true;
+}
+
+void timingLoopEnd(uint8_t state) {
+    if (state >= TIMING_MAX_STATES) return;
+    uint16_t& slot = passHistogram[state][bucketFor(micros() - passStartUs)];
+    if (slot < 0xFFFF) slot++;
+}
+
+void timingAddSection(uint8_t section, uint32_t elapsedUs) {
+    if (section >= TIMING_SECTION_COUNT) return;
+    SectionStats& s = sections[section];
+    s.totalUs += elapsedUs;
+    if (elapsedUs > s.maxUs) s.maxUs = elapsedUs;
+    s.calls++;
+}
+
+// Little-endian writer that keeps the running checksum
+struct ReportWriter {
+    Print& out;
+    uint8_t sum;
+
+    void byte(uint8_t b) {
+        out.write(b);
+        sum += b;
+    }
+    void u16(uint16_t v) {
+        byte(v & 0xFF);
+        byte(v >> 8);
+    }
+    void u32(uint32_t v) {
+        u16(v & 0xFFFF);
+        u16(v >> 16);
+    }
+};
+
+void timingDump(Print& out) {
+    StepTimingStats step;
+    stepEngineTimingStats(step);
+
+    uint16_t length = 9 + 4 * 4 + TIMING_SECTION_COUNT * 3 * 4 +
+                      TIMING_MAX_STATES * TIMING_BUCKETS * 2 + 5 * 4 + MAX_STEP_AXES * 4 + 1;
+
+    ReportWriter w = {out, 0};
+    w.byte(0xA5);
+    w.byte(0x5A);
+    w.byte(TIMING_REPORT_VERSION);
+    w.byte(TIMING_MAX_STATES);
+    w.byte(TIMING_BUCKETS);
+    w.byte(TIMING_SECTION_COUNT);
+    w.byte(MAX_STEP_AXES);
+    w.u16(length);
+
+    w.u32(loops);
+    w.u32(loopMinUs);
+    w.u32(loopMaxUs);
+    w.u32(loops ? (uint32_t)(loopTotalUs / loops) : 0);
+
+    for (uint8_t i = 0; i < TIMING_SECTION_COUNT; i++) w.u32(sections[i].totalUs);
+    for (uint8_t i = 0; i < TIMING_SECTION_COUNT; i++) w.u32(sections[i].maxUs);
+    for (uint8_t i = 0; i < TIMING_SECTION_COUNT; i++) w.u32(sections[i].calls);
+
+    for (uint8_t s = 0; s < TIMING_MAX_STATES; s++) {
+        for (uint8_t b = 0; b < TIMING_BUCKETS; b++) w.u16(passHistogram[s][b]);
+    }
+
+    w.u32(step.ticks);
+    w.u32(step.lateTicks);
+    w.u32(step.periodCycles);
+    w.u32(step.maxJitterCycles);
+    w.u32(step.maxTickCycles);
+    for (uint8_t i = 0; i < MAX_STEP_AXES; i++) w.u32(step.lateSteps[i]);
+
+    out.write(w.sum);
+}
+
+void timingReset() {
+    loops = 0;
+    loopMinUs = 0;
+    loopMaxUs = 0;
+    loopTotalUs = 0;
+    havePrevious = false;
+    memset(sections, 0, sizeof(sections));
+    memset(passHistogram, 0, sizeof(passHistogram));
+    stepEngineResetTiming();
+}